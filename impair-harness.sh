@@ -0,0 +1,59 @@
+#!/usr/bin/env bash
+
+# Runs sync_harness through the impair proxy under a range of network conditions and prints one row per scenario.
+# Build first (./build.sh), then: ./impair-harness.sh [-t seconds] [-r moves per second]
+
+# Exit the script if any command fails
+set -e
+
+build_dir="${BUILD_DIR:-./build}"
+seconds=5
+rate=60
+ip="127.0.0.1"
+proxy_a=6100
+proxy_b=6101
+port_a=6200
+port_b=6201
+
+while getopts ":t:r:" opt; do
+  case $opt in
+    t) seconds="$OPTARG" ;;
+    r) rate="$OPTARG" ;;
+    \?) echo "Invalid option: -$OPTARG" >&2; exit 1 ;;
+    :) echo "Option -$OPTARG requires an argument." >&2; exit 1 ;;
+  esac
+done
+
+if [ ! -x "$build_dir/impair" ] || [ ! -x "$build_dir/sync_harness" ]; then
+  echo "You must run ./build.sh first (looked in $build_dir)"
+  exit 1
+fi
+
+# name followed by impair flags
+scenarios=(
+  "clean|"
+  "delay-50|-d 50"
+  "jitter-50+-30|-d 50 -j 30"
+  "loss-5|-L 5"
+  "loss-20|-L 20"
+  "reorder-10|-R 10 -H 30"
+  "duplicate-10|-D 10"
+  "wan-mix|-d 40 -j 20 -L 3 -R 5 -D 2"
+)
+
+printf "%-24s %10s %10s %10s %10s %10s %10s %12s %8s\n" "scenario" "rtt p50" "rtt p99" "lag p50" "lag p99" "lag max" "applied/s" "bytes/s" "resyncs"
+
+for scenario in "${scenarios[@]}"; do
+  name="${scenario%%|*}"
+  flags="${scenario#*|}"
+
+  # shellcheck disable=SC2086
+  "$build_dir/impair" -i "$ip" -a "$proxy_a" -b "$proxy_b" -A "$port_a" -B "$port_b" -s 42 $flags > /dev/null &
+  proxy_pid=$!
+  sleep 0.2
+
+  "$build_dir/sync_harness" -i "$ip" -a "$proxy_a" -b "$proxy_b" -A "$port_a" -B "$port_b" -t "$seconds" -r "$rate" -n "$name"
+
+  kill -INT "$proxy_pid"
+  wait "$proxy_pid" || true
+done
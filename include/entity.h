@@ -0,0 +1,40 @@
+#ifndef ENTITY_H
+#define ENTITY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ENTITY_PROJECTILE 0
+#define ENTITY_PICKUP 1
+#define ENTITY_HAZARD 2
+#define ENTITY_KINDS 3
+#define ENTITY_LANES 4    // floats handled per vector instruction
+#define ENTITY_ALIGN (ENTITY_LANES * sizeof(float))
+
+// Projectiles, pickups and hazards on the board, stored as one array per field so movement, wall
+// clamping and collision tests each stream through contiguous floats ENTITY_LANES at a time.
+// Positions are in board cells and velocities in cells per second. Slots stay dense: despawning
+// moves the last entity into the hole, so a kind's index is only stable until the next despawn.
+typedef struct
+{
+    float   *x;
+    float   *y;
+    float   *vx;
+    float   *vy;
+    uint8_t *kind;
+    size_t   count;
+    size_t   capacity;
+    float    min_x;
+    float    min_y;
+    float    max_x;
+    float    max_y;
+} entity_world;
+
+int    entity_world_init(entity_world *world, size_t capacity, float min_x, float min_y, float max_x, float max_y);
+void   entity_world_destroy(entity_world *world);
+long   entity_spawn(entity_world *world, uint8_t kind, float x, float y, float vx, float vy);
+void   entity_despawn(entity_world *world, size_t index);
+void   entity_step(entity_world *world, float dt);
+size_t entity_collide(const entity_world *world, float px, float py, float radius, size_t *hits, size_t max_hits);
+
+#endif    // ENTITY_H
@@ -0,0 +1,72 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define METRICS_SHARDS 8
+#define METRICS_STATES 16
+#define METRICS_BUCKETS 12
+#define METRICS_FILE_INTERVAL_MS 1000
+#define METRICS_PATH_MAX 256
+
+// Counters, indexed into metrics_shard.counters
+#define METRIC_PACKETS_SENT 0
+#define METRIC_PACKETS_RECEIVED 1
+#define METRIC_INVALID_MOVES 2
+#define METRIC_TIMER_MOVES 3
+#define METRIC_SOCKET_ERRORS 4
+#define METRIC_MOVES_COALESCED 5
+#define METRIC_COUNTERS 6
+
+// Latency histograms, indexed into metrics_shard.histograms
+#define METRIC_MOVE_LATENCY 0      // input noticed -> move sent to the peer
+#define METRIC_PACKET_LATENCY 1    // datagram received -> board updated
+#define METRIC_PEER_RTT 2          // update sent -> peer's ack received
+#define METRIC_HISTOGRAMS 3
+
+// Bucket counts are per bucket, not cumulative; the last one is +Inf
+typedef struct
+{
+    atomic_uint_least64_t buckets[METRICS_BUCKETS + 1];
+    atomic_uint_least64_t sum_us;
+} metrics_histogram;
+
+// Everything one thread counts. Only that thread writes to it, and each shard has its own cache
+// lines, so counting never needs a locked instruction and never bounces a line between cores.
+typedef struct
+{
+    _Alignas(64) atomic_uint_least64_t counters[METRIC_COUNTERS];
+    atomic_uint_least64_t transitions[METRICS_STATES];
+    metrics_histogram     histograms[METRIC_HISTOGRAMS];
+} metrics_shard;
+
+// The shards of every thread, summed only when someone reads them: an HTTP scrape of
+// 127.0.0.1:<port>/metrics, or a text file rewritten once a second, both in Prometheus text format
+typedef struct
+{
+    metrics_shard      shards[METRICS_SHARDS];
+    atomic_int         count;
+    const char *const *state_names;
+    int                state_count;
+    int                listen_sock;
+    char               path[METRICS_PATH_MAX];
+    int                stop_fds[2];
+    pthread_t          thread;
+    bool               running;
+} metrics_registry;
+
+void           metrics_init(metrics_registry *reg, const char *const *state_names, int state_count);
+metrics_shard *metrics_register(metrics_registry *reg);
+void           metrics_count(metrics_shard *shard, int counter);
+void           metrics_transition(metrics_shard *shard, int state);
+void           metrics_observe_us(metrics_shard *shard, int histogram, int64_t us);
+uint64_t       metrics_total(metrics_registry *reg, int counter);
+size_t         metrics_format(metrics_registry *reg, char *out, size_t cap);
+int            metrics_export_start(metrics_registry *reg, in_port_t port, const char *path);
+void           metrics_export_stop(metrics_registry *reg);
+
+#endif    // METRICS_H
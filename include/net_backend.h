@@ -0,0 +1,83 @@
+#ifndef NET_BACKEND_H
+#define NET_BACKEND_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#define NET_BACKEND_CLASSIC 0
+#define NET_BACKEND_URING 1
+#define NET_READY_PACKET 1
+#define NET_READY_EXTRA 2
+#define NET_PACKET_MAX 512
+#define NET_URING_ENTRIES 64
+#define NET_URING_RECV_SLOTS 16
+#define NET_URING_SEND_SLOTS 16
+
+#ifdef __linux__
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+// A datagram buffer with the msghdr that io_uring reads or fills in place
+typedef struct
+{
+    struct msghdr           msg;
+    struct iovec            iov;
+    struct sockaddr_storage addr;
+    size_t                  len;
+    uint8_t                 buf[NET_PACKET_MAX];
+} net_slot;
+#endif
+
+// Sends and receives datagrams on an already bound UDP socket, either with one syscall per
+// operation (select/sendto/recvfrom) or through an io_uring with pre-posted receives and batched sends
+typedef struct
+{
+    int                     backend;
+    int                     sock;
+    struct sockaddr_storage remote_addr;
+    socklen_t               remote_addr_len;
+    uint64_t                syscalls;
+    uint64_t                sent;
+    uint64_t                received;
+    uint64_t                errors;
+#ifdef __linux__
+    int                  ring_fd;
+    void                *sq_ring;
+    size_t               sq_ring_len;
+    void                *cq_ring;
+    size_t               cq_ring_len;
+    struct io_uring_sqe *sqes;
+    size_t               sqes_len;
+    unsigned            *sq_head;
+    unsigned            *sq_tail;
+    unsigned            *sq_mask;
+    unsigned            *sq_array;
+    unsigned             sq_entries;
+    unsigned            *cq_head;
+    unsigned            *cq_tail;
+    unsigned            *cq_mask;
+    struct io_uring_cqe *cqes;
+    uint32_t             send_free;
+    uint32_t             recv_unposted;    // receive buffers waiting for room on the SQ
+    bool                 poll_armed;
+    bool                 extra_ready;
+    unsigned             ready[NET_URING_RECV_SLOTS];
+    unsigned             ready_head;
+    unsigned             ready_count;
+    net_slot             recv_slots[NET_URING_RECV_SLOTS];
+    net_slot             send_slots[NET_URING_SEND_SLOTS];
+#endif
+} net_backend;
+
+int         net_backend_open(net_backend *net, int backend, int sock, const struct sockaddr_storage *remote_addr, socklen_t remote_addr_len);
+int         net_backend_wait(net_backend *net, int extra_fd, int timeout_ms);
+int         net_backend_send(net_backend *net, const void *buf, size_t len);
+int         net_backend_flush(net_backend *net);
+ssize_t     net_backend_recv(net_backend *net, void *buf, size_t cap, struct sockaddr_storage *from, socklen_t *from_len);
+void        net_backend_close(net_backend *net);
+const char *net_backend_name(int backend);
+
+#endif    // NET_BACKEND_H
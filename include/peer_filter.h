@@ -0,0 +1,47 @@
+#ifndef PEER_FILTER_H
+#define PEER_FILTER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#define PEER_FILTER_MAX 4
+#define PEER_ACCEPT 0
+#define PEER_DROP_UNKNOWN 1
+#define PEER_DROP_RATE 2
+#define PEER_DROP_MALFORMED 3
+
+// A known sender and its token bucket; tokens are kept in thousandths to avoid floating point
+typedef struct
+{
+    struct sockaddr_storage addr;
+    uint64_t                tokens_milli;
+    int64_t                 last_refill_ns;
+} peer_entry;
+
+// Drop counters, indexed by the PEER_* verdicts
+typedef struct
+{
+    uint64_t accepted;
+    uint64_t dropped_unknown;
+    uint64_t dropped_rate;
+    uint64_t dropped_malformed;
+} peer_counters;
+
+// Decides, before any decoding or drawing, whether a datagram is worth looking at
+typedef struct
+{
+    peer_entry    peers[PEER_FILTER_MAX];
+    int           count;
+    uint32_t      rate;
+    uint32_t      burst;
+    peer_counters counters;
+} peer_filter;
+
+void peer_filter_init(peer_filter *filter, uint32_t rate, uint32_t burst);
+int  peer_filter_add(peer_filter *filter, const struct sockaddr_storage *addr);
+int  peer_filter_check(peer_filter *filter, const struct sockaddr_storage *from);
+void peer_filter_count_malformed(peer_filter *filter);
+bool peer_same_address(const struct sockaddr_storage *a, const struct sockaddr_storage *b);
+
+#endif    // PEER_FILTER_H
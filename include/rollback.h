@@ -0,0 +1,71 @@
+#ifndef ROLLBACK_H
+#define ROLLBACK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define ROLLBACK_PLAYERS 2
+#define ROLLBACK_WINDOW 16            // saved states, so the deepest possible rollback
+#define ROLLBACK_MAX_PREDICTION 8     // frames we may run past the last confirmed remote input
+#define ROLLBACK_INPUT_RING 32        // our inputs the remote has not confirmed, and the remote's we cannot use yet
+#define ROLLBACK_MAX_DELAY 8
+#define ROLLBACK_SYNC_LEAD 2          // frames ahead of the remote before we idle a frame to let it catch up
+#define ROLLBACK_MSG_INPUTS ROLLBACK_INPUT_RING    // every unconfirmed input fits in one message
+#define ROLLBACK_INPUT_NONE 0
+#define ROLLBACK_MSG_INPUT 'I'
+#define ROLLBACK_MSG_HEADER 15        // tag, sender's frame, sender's lead, sender's confirmed frame, first input frame, count
+#define ROLLBACK_MSG_MAX (ROLLBACK_MSG_HEADER + ROLLBACK_MSG_INPUTS)
+
+// Advances the game one frame. state is the caller's whole game state; inputs has one entry per player.
+// Must depend on nothing but its arguments, since frames are re-run after a misprediction.
+typedef void (*rollback_step_fn)(void *ctx, uint8_t *state, const uint8_t *inputs);
+
+// One player's input for one frame
+typedef struct
+{
+    uint32_t frame;
+    bool     known;
+    uint8_t  input;
+} rollback_input;
+
+// A GGPO-style session for two players. Local inputs are scheduled delay frames ahead, and the remote
+// player's missing inputs are predicted as no input. When a real input turns out to differ, the state
+// saved before that frame is restored and every frame since is re-run with the corrected inputs.
+// The state is one contiguous block, so saving and restoring it are a single memcpy each.
+typedef struct
+{
+    uint8_t         *state;
+    size_t           state_size;
+    uint8_t         *snapshots;    // ROLLBACK_WINDOW copies of state, each taken before its frame ran
+    rollback_step_fn step;
+    void            *ctx;
+    int              local_player;
+    uint32_t         delay;
+    uint32_t         frame;        // the next frame to run
+    uint32_t         confirmed;    // every remote input before this frame is known
+    rollback_input   local[ROLLBACK_INPUT_RING];
+    rollback_input   remote[ROLLBACK_INPUT_RING];
+    uint8_t          used[ROLLBACK_INPUT_RING];    // remote input each frame actually ran with
+    bool             rollback_pending;
+    uint32_t         rollback_from;
+    uint32_t         remote_frame;    // the remote's own frame when it last sent
+    int32_t          remote_lead;     // how far it thought it was ahead of us then
+    uint32_t         remote_ack;      // the remote has every one of our inputs before this frame
+    bool             has_remote;
+    uint64_t         rollbacks;
+    uint64_t         resimulated;
+    uint64_t         mispredictions;
+    uint64_t         stalls;
+    uint32_t         deepest;
+} rollback_session;
+
+int    rollback_init(rollback_session *rb, uint8_t *state, size_t state_size, rollback_step_fn step, void *ctx, int local_player, uint32_t delay);
+void   rollback_destroy(rollback_session *rb);
+bool   rollback_advance(rollback_session *rb, uint8_t local_input);
+void   rollback_add_remote(rollback_session *rb, uint32_t frame, uint8_t input);
+size_t rollback_encode_inputs(const rollback_session *rb, uint8_t *out, size_t cap);
+int    rollback_decode_inputs(rollback_session *rb, const uint8_t *in, size_t in_len);
+bool   rollback_plausible(const uint8_t *in, size_t in_len);
+
+#endif    // ROLLBACK_H
@@ -0,0 +1,60 @@
+#ifndef SDL_RENDER_H
+#define SDL_RENDER_H
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wswitch-default"
+#ifdef __clang__
+    #pragma clang diagnostic push
+    #pragma clang diagnostic ignored "-Wreserved-macro-identifier"
+    #pragma clang diagnostic ignored "-Wreserved-identifier"
+    #pragma clang diagnostic ignored "-Wdocumentation-unknown-command"
+#endif
+#include <SDL2/SDL.h>
+#pragma GCC diagnostic pop
+#ifdef __clang__
+    #pragma clang diagnostic pop
+#endif
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TILE_EMPTY 0
+#define TILE_WALL 1
+#define TILE_LOCAL 2
+#define TILE_REMOTE 3
+#define TILE_KINDS 4
+#define TILE_UNDRAWN 0xFF
+
+// Draws a board of tiles through SDL's software renderer into a streaming texture. Only tiles whose
+// contents changed since the last frame are rewritten and copied, and with a non-zero fps frames are
+// presented at most that often. Works under SDL_VIDEODRIVER=dummy.
+typedef struct
+{
+    SDL_Window   *window;
+    SDL_Renderer *renderer;
+    SDL_Texture  *texture;
+    int           cols;
+    int           lines;
+    int           tile_px;
+    uint8_t      *tiles;
+    uint8_t      *drawn;
+    uint8_t      *queued;
+    uint32_t     *dirty;
+    uint32_t      dirty_count;
+    bool          full_copy;
+    uint32_t      frame_ms;
+    uint32_t      next_frame_at;
+    uint64_t      frames;
+    uint64_t      tiles_drawn;
+    SDL_Keycode   key;
+    bool          quit;
+} sdl_renderer;
+
+int  sdl_render_open(sdl_renderer *r, const char *title, int cols, int lines, int tile_px, int fps);
+void sdl_render_set(sdl_renderer *r, int x, int y, uint8_t tile);
+void sdl_render_border(sdl_renderer *r);
+void sdl_render_invalidate(sdl_renderer *r);
+bool sdl_render_frame(sdl_renderer *r);
+int  sdl_render_timeout(const sdl_renderer *r, int timeout_ms);
+void sdl_render_close(sdl_renderer *r);
+
+#endif    // SDL_RENDER_H
@@ -0,0 +1,27 @@
+#ifndef SEND_SCHEDULER_H
+#define SEND_SCHEDULER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Caps how often local moves go out to the peer. Every update carries the whole position, so moves
+// made between two sends fold into one datagram holding their net displacement. A move made after
+// the line has been quiet for a full interval goes out at once, so single key presses see no delay.
+typedef struct
+{
+    int64_t  interval_us;
+    int64_t  last_sent_us;
+    int64_t  pending_since_us;
+    bool     pending;
+    bool     has_sent;
+    uint64_t sent;
+    uint64_t coalesced;
+} send_scheduler;
+
+void send_scheduler_init(send_scheduler *sched, uint32_t rate_hz);
+void send_scheduler_queue(send_scheduler *sched, int64_t noticed_us);
+bool send_scheduler_due(const send_scheduler *sched, int64_t now_us);
+void send_scheduler_sent(send_scheduler *sched, int64_t now_us);
+int  send_scheduler_timeout(const send_scheduler *sched, int64_t now_us, int timeout_ms);
+
+#endif    // SEND_SCHEDULER_H
@@ -0,0 +1,67 @@
+#ifndef SPECTATE_H
+#define SPECTATE_H
+
+#include "sync.h"
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#define SPECTATE_KEYFRAME_MS 1000
+#define SPECTATE_KEYFRAME_UPDATES (SYNC_HISTORY / 2)
+#define SPECTATE_SOURCES 4
+#define SPECTATE_STALE_RESET 2
+#define SPECTATE_EXPIRE_MS (3 * SPECTATE_KEYFRAME_MS)
+
+// Publishes the board to a multicast group, so the cost per update is one datagram however many
+// spectators are listening. Deltas are against the last keyframe, and keyframes go out at least once
+// a second so a spectator who joins midway catches up quickly.
+typedef struct
+{
+    int                     sock;
+    struct sockaddr_storage group;
+    socklen_t               group_len;
+    sync_state              sync;
+    int64_t                 next_keyframe_ms;
+    uint32_t                since_keyframe;
+    uint8_t                 state[SYNC_STATE_MAX];
+    size_t                  state_len;
+    uint64_t                sent;
+    uint64_t                errors;
+} spectate_publisher;
+
+// One publishing player as seen by a spectator
+typedef struct
+{
+    struct sockaddr_storage addr;
+    sync_state              sync;
+    uint8_t                 state[SYNC_STATE_MAX];
+    size_t                  state_len;
+    bool                    has_state;
+    uint32_t                stale_snapshots;
+    int64_t                 last_heard_ms;
+    int                     mark;    // 0 to SPECTATE_SOURCES - 1, unique among live sources and kept until expiry
+} spectate_source;
+
+// Everything a spectator has pieced together from the group
+typedef struct
+{
+    spectate_source sources[SPECTATE_SOURCES];
+    int             count;
+    uint64_t        updates;
+    uint64_t        missing_baseline;
+    uint64_t        ignored;
+} spectate_view;
+
+int  spectate_publisher_open(spectate_publisher *pub, const struct sockaddr_storage *group, socklen_t group_len, const char *interface_ip);
+void spectate_publish(spectate_publisher *pub, const uint8_t *state, size_t len, int64_t now_ms);
+void spectate_tick(spectate_publisher *pub, int64_t now_ms);
+int  spectate_timeout(const spectate_publisher *pub, int64_t now_ms, int timeout_ms);
+void spectate_publisher_close(spectate_publisher *pub);
+int  spectate_listen(const struct sockaddr_storage *group, socklen_t group_len, const char *interface_ip);
+void spectate_view_init(spectate_view *view);
+int  spectate_view_receive(spectate_view *view, const struct sockaddr_storage *from, const uint8_t *buf, size_t len, int64_t now_ms);
+bool spectate_view_expire(spectate_view *view, int64_t now_ms);
+
+#endif    // SPECTATE_H
@@ -0,0 +1,46 @@
+#ifndef SPSC_H
+#define SPSC_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SPSC_CACHE_LINE 64
+
+// A bounded queue of fixed-size records between exactly one producer thread and one consumer
+// thread. Each side only writes its own index, so no locks are needed; the indices sit on
+// separate cache lines so the two threads do not keep stealing the line from each other.
+typedef struct
+{
+    _Alignas(SPSC_CACHE_LINE) atomic_size_t head;    // next record to pop, written by the consumer
+    size_t cached_tail;                              // consumer's last look at tail
+    _Alignas(SPSC_CACHE_LINE) atomic_size_t tail;    // next slot to push, written by the producer
+    size_t cached_head;                              // producer's last look at head
+    _Alignas(SPSC_CACHE_LINE) size_t record_size;
+    size_t   mask;
+    uint8_t *records;
+} spsc_ring;
+
+// Lets a consumer sleep in poll() until a producer has pushed something. Producers only make
+// the write() syscall when the consumer has said it is about to sleep.
+typedef struct
+{
+    int         fds[2];
+    atomic_bool sleeping;
+} spsc_doorbell;
+
+int  spsc_init(spsc_ring *ring, size_t record_size, size_t capacity);
+bool spsc_push(spsc_ring *ring, const void *record);
+bool spsc_pop(spsc_ring *ring, void *record);
+bool spsc_empty(spsc_ring *ring);
+void spsc_destroy(spsc_ring *ring);
+int  spsc_doorbell_init(spsc_doorbell *bell);
+void spsc_doorbell_ring(spsc_doorbell *bell);
+void spsc_doorbell_wake(spsc_doorbell *bell);
+void spsc_doorbell_arm(spsc_doorbell *bell);
+void spsc_doorbell_disarm(spsc_doorbell *bell);
+int  spsc_doorbell_wait(spsc_doorbell *bell, spsc_ring *const rings[], int count, int timeout_ms);
+void spsc_doorbell_destroy(spsc_doorbell *bell);
+
+#endif    // SPSC_H
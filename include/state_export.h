@@ -0,0 +1,68 @@
+#ifndef STATE_EXPORT_H
+#define STATE_EXPORT_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define STATE_EXPORT_MAGIC 0x33393830U    // "3980"
+#define STATE_EXPORT_VERSION 1
+#define STATE_EXPORT_NAME_MAX 64
+#define STATE_EXPORT_READ_TRIES 64
+
+// Fields, indexed into state_export_page.fields and state_snapshot.fields. New ones only ever go on
+// the end, so a reader built against an older layout still finds the fields it knows.
+#define STATE_FIELD_LOCAL_X 0
+#define STATE_FIELD_LOCAL_Y 1
+#define STATE_FIELD_REMOTE_X 2
+#define STATE_FIELD_REMOTE_Y 3
+#define STATE_FIELD_UPDATED_US 4          // CLOCK_MONOTONIC microseconds of the last change to any other field
+#define STATE_FIELD_PACKETS_SENT 5
+#define STATE_FIELD_PACKETS_RECEIVED 6
+#define STATE_FIELD_INVALID_MOVES 7
+#define STATE_FIELD_TIMER_MOVES 8
+#define STATE_FIELD_MOVES_SENT 9
+#define STATE_FIELD_MOVES_COALESCED 10
+#define STATE_FIELD_ROLLBACK_FRAME 11     // 0 outside rollback mode
+#define STATE_FIELD_ROLLBACKS 12
+#define STATE_FIELDS 13
+
+// The shared segment. magic is stored last, once everything else is in place. seq is a seqlock: the
+// one writer makes it odd, stores the fields, then makes it even again, so a reader that sees the
+// same even seq before and after copying the fields has a consistent snapshot. Readers never write,
+// so any number of them can map the segment read-only and poll it as often as they like.
+typedef struct
+{
+    atomic_uint_least32_t magic;
+    uint32_t              version;
+    uint32_t              field_count;
+    int32_t               pid;
+    _Alignas(64) atomic_uint_least64_t seq;
+    atomic_int_least64_t  fields[STATE_FIELDS];
+} state_export_page;
+
+// One consistent copy of the fields; seq / 2 is how many updates the writer has published
+typedef struct
+{
+    uint64_t seq;
+    int32_t  pid;
+    int64_t  fields[STATE_FIELDS];
+} state_snapshot;
+
+// Either end of a segment: the game creates and publishes to it, tools attach to it and read
+typedef struct
+{
+    state_export_page *page;
+    char               name[STATE_EXPORT_NAME_MAX];
+    bool               owner;
+    int64_t            last[STATE_FIELDS];    // the writer's last published fields
+} state_export;
+
+int  state_export_open(state_export *exp, const char *name);
+void state_export_publish(state_export *exp, const int64_t *fields, int64_t now_us);
+int  state_export_attach(state_export *exp, const char *name);
+bool state_export_read(const state_export *exp, state_snapshot *snap);
+bool state_export_live(const state_export *exp);
+void state_export_close(state_export *exp);
+
+#endif    // STATE_EXPORT_H
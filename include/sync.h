@@ -0,0 +1,61 @@
+#ifndef SYNC_H
+#define SYNC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Datagrams that are exactly sizeof(uint16_t) long are legacy direction moves,
+// everything else starts with one of these tags.
+#define SYNC_MSG_JOIN 'J'
+#define SYNC_MSG_SNAPSHOT 'S'
+#define SYNC_MSG_DELTA 'D'
+#define SYNC_MSG_ACK 'A'
+#define SYNC_MISSING_BASELINE (-2)
+
+#define SYNC_HISTORY 32
+#define SYNC_STATE_MAX 64
+#define SYNC_MASK_MAX ((SYNC_STATE_MAX + 7) / 8)
+#define SYNC_HEADER_LEN 5
+#define SYNC_PACKET_MAX (SYNC_HEADER_LEN + SYNC_MASK_MAX + SYNC_STATE_MAX)
+
+// One serialised copy of the game state, tagged with the sequence it was sent or received as
+typedef struct
+{
+    uint16_t seq;
+    uint16_t len;
+    bool     valid;
+    uint8_t  bytes[SYNC_STATE_MAX];
+} sync_frame;
+
+// Per-peer bookkeeping for snapshots and deltas in both directions
+typedef struct
+{
+    uint16_t   next_seq;
+    uint16_t   acked_seq;
+    bool       has_ack;
+    uint16_t   last_received_seq;
+    bool       has_received;
+    sync_frame sent[SYNC_HISTORY];
+    sync_frame received[SYNC_HISTORY];
+} sync_state;
+
+// A decoded datagram; state holds the full reconstructed state for snapshots and deltas
+typedef struct
+{
+    int      type;
+    uint16_t seq;
+    uint16_t len;
+    uint8_t  state[SYNC_STATE_MAX];
+} sync_message;
+
+void   sync_init(sync_state *sync);
+size_t sync_encode_join(uint8_t *out, size_t cap);
+size_t sync_encode_ack(uint16_t seq, uint8_t *out, size_t cap);
+size_t sync_encode_snapshot(sync_state *sync, const uint8_t *state, size_t len, uint8_t *out, size_t cap);
+size_t sync_encode_keyframe(sync_state *sync, const uint8_t *state, size_t len, uint8_t *out, size_t cap);
+size_t sync_encode_update(sync_state *sync, const uint8_t *state, size_t len, uint8_t *out, size_t cap);
+bool   sync_plausible(const uint8_t *in, size_t in_len);
+int    sync_decode(sync_state *sync, const uint8_t *in, size_t in_len, sync_message *msg);
+
+#endif    // SYNC_H
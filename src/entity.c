@@ -0,0 +1,208 @@
+#include "entity.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// GCC and clang lower these to SSE on x86-64 and NEON on arm64, and to pairs of scalar operations
+// anywhere else, so there is one implementation for every target
+typedef float   vec_f __attribute__((vector_size(ENTITY_LANES * sizeof(float))));
+typedef int32_t vec_i __attribute__((vector_size(ENTITY_LANES * sizeof(int32_t))));
+
+_Static_assert(ENTITY_LANES == 4, "splat() and the lane test in entity_collide() are written out for four lanes");
+
+static float *alloc_lanes(size_t capacity);
+static vec_f  splat(float value);
+static vec_f  load(const float *src);
+static void   store(float *dst, vec_f value);
+static vec_f  select_f(vec_i mask, vec_f a, vec_f b);
+static void   bounce(vec_f *p, vec_f *v, vec_f lo, vec_f hi);
+
+// Capacity is rounded up to whole vectors, so the last vector never reads or writes past the arrays.
+// Entities bounce off [min, max] on both axes.
+int entity_world_init(entity_world *world, size_t capacity, float min_x, float min_y, float max_x, float max_y)
+{
+    memset(world, 0, sizeof(*world));
+    world->capacity = (capacity + ENTITY_LANES - 1) / ENTITY_LANES * ENTITY_LANES;
+    world->min_x    = min_x;
+    world->min_y    = min_y;
+    world->max_x    = max_x;
+    world->max_y    = max_y;
+    world->x        = alloc_lanes(world->capacity);
+    world->y        = alloc_lanes(world->capacity);
+    world->vx       = alloc_lanes(world->capacity);
+    world->vy       = alloc_lanes(world->capacity);
+    world->kind     = (uint8_t *)calloc(world->capacity, sizeof(uint8_t));
+    if(world->x == NULL || world->y == NULL || world->vx == NULL || world->vy == NULL || world->kind == NULL)
+    {
+        perror("entity_world_init");
+        entity_world_destroy(world);
+        return -1;
+    }
+    return 0;
+}
+
+void entity_world_destroy(entity_world *world)
+{
+    free(world->x);
+    free(world->y);
+    free(world->vx);
+    free(world->vy);
+    free(world->kind);
+    memset(world, 0, sizeof(*world));
+}
+
+// Returns the new entity's index, or -1 when the world is full
+long entity_spawn(entity_world *world, uint8_t kind, float x, float y, float vx, float vy)
+{
+    size_t index;
+
+    if(world->count == world->capacity || kind >= ENTITY_KINDS)
+    {
+        return -1;
+    }
+    index              = world->count++;
+    world->x[index]    = x;
+    world->y[index]    = y;
+    world->vx[index]   = vx;
+    world->vy[index]   = vy;
+    world->kind[index] = kind;
+    return (long)index;
+}
+
+void entity_despawn(entity_world *world, size_t index)
+{
+    size_t last;
+
+    if(index >= world->count)
+    {
+        return;
+    }
+    last               = --world->count;
+    world->x[index]    = world->x[last];
+    world->y[index]    = world->y[last];
+    world->vx[index]   = world->vx[last];
+    world->vy[index]   = world->vy[last];
+    world->kind[index] = world->kind[last];
+}
+
+// Moves every entity dt seconds along its velocity, clamping it to the walls and reversing whichever
+// component hit one. Pickups have no velocity, so they stay put without a branch on kind.
+void entity_step(entity_world *world, float dt)
+{
+    float *const xs    = world->x;
+    float *const ys    = world->y;
+    float *const vxs   = world->vx;
+    float *const vys   = world->vy;
+    const size_t count = world->count;
+    const vec_f  step  = splat(dt);
+    const vec_f  min_x = splat(world->min_x);
+    const vec_f  min_y = splat(world->min_y);
+    const vec_f  max_x = splat(world->max_x);
+    const vec_f  max_y = splat(world->max_y);
+
+    // The lanes past count in the last vector are spare capacity, so moving them too is harmless
+    for(size_t i = 0; i < count; i += ENTITY_LANES)
+    {
+        vec_f x  = load(&xs[i]);
+        vec_f y  = load(&ys[i]);
+        vec_f vx = load(&vxs[i]);
+        vec_f vy = load(&vys[i]);
+
+        x += vx * step;
+        y += vy * step;
+        bounce(&x, &vx, min_x, max_x);
+        bounce(&y, &vy, min_y, max_y);
+        store(&xs[i], x);
+        store(&ys[i], y);
+        store(&vxs[i], vx);
+        store(&vys[i], vy);
+    }
+}
+
+// Writes the index of every entity within radius of (px, py) to hits, up to max_hits of them, and
+// returns how many there were in all. Hits are rare, so vectors with none cost one test and no stores.
+// Despawning them in reverse order keeps the remaining indices valid.
+size_t entity_collide(const entity_world *world, float px, float py, float radius, size_t *hits, size_t max_hits)
+{
+    const float *xs    = world->x;
+    const float *ys    = world->y;
+    const size_t count = world->count;
+    const vec_f  cx    = splat(px);
+    const vec_f  cy    = splat(py);
+    const vec_f  reach = splat(radius * radius);
+    size_t       found = 0;
+
+    for(size_t i = 0; i < count; i += ENTITY_LANES)
+    {
+        vec_f dx  = load(&xs[i]) - cx;
+        vec_f dy  = load(&ys[i]) - cy;
+        vec_i hit = (dx * dx + dy * dy) <= reach;
+
+        if((hit[0] | hit[1] | hit[2] | hit[3]) == 0)
+        {
+            continue;
+        }
+        // Spare lanes past count are skipped here rather than masked on every vector
+        for(size_t l = 0; l < ENTITY_LANES && i + l < count; l++)
+        {
+            if(hit[l] != 0)
+            {
+                if(found < max_hits)
+                {
+                    hits[found] = i + l;
+                }
+                found++;
+            }
+        }
+    }
+    return found;
+}
+
+// Zeroed, so spare lanes hold ordinary numbers rather than whatever the allocator left
+static float *alloc_lanes(size_t capacity)
+{
+    float *lanes = (float *)aligned_alloc(ENTITY_ALIGN, (capacity > 0 ? capacity : ENTITY_LANES) * sizeof(float));
+
+    if(lanes != NULL)
+    {
+        memset(lanes, 0, (capacity > 0 ? capacity : ENTITY_LANES) * sizeof(float));
+    }
+    return lanes;
+}
+
+static vec_f splat(float value)
+{
+    vec_f v = {value, value, value, value};
+
+    return v;
+}
+
+// memcpy keeps the loads and stores free of aliasing questions; it compiles to a single vector move
+static vec_f load(const float *src)
+{
+    vec_f v;
+
+    memcpy(&v, src, sizeof(v));
+    return v;
+}
+
+static void store(float *dst, vec_f value)
+{
+    memcpy(dst, &value, sizeof(value));
+}
+
+// a where mask is set, b elsewhere
+static vec_f select_f(vec_i mask, vec_f a, vec_f b)
+{
+    return (vec_f)(((vec_i)a & mask) | ((vec_i)b & ~mask));
+}
+
+// Clamps p into [lo, hi] and reverses v in every lane that had to be clamped
+static void bounce(vec_f *p, vec_f *v, vec_f lo, vec_f hi)
+{
+    vec_i below = *p < lo;
+    vec_i above = *p > hi;
+
+    *p = select_f(below, lo, select_f(above, hi, *p));
+    *v = select_f(below | above, -*v, *v);
+}
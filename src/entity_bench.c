@@ -0,0 +1,237 @@
+#include "entity.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DEFAULT_FRAMES 600
+#define FRAME_BUDGET_MS 16.0
+#define FRAME_DT (1.0F / 60.0F)
+#define BOARD_MIN 1.0F
+#define BOARD_MAX 38.0F
+#define MAX_SPEED 20.0F
+#define PLAYER_RADIUS 0.5F
+#define PLAYERS 2
+#define MAX_HITS 1024
+#define TOLERANCE 1e-3F
+#define MILLIS_PER_SEC 1000.0
+#define NANOS_PER_MILLI 1000000.0
+
+// The same world kept as plain per-entity arrays and stepped one branch at a time, the way the
+// players' own bounds checks are written, to check the vector results and measure the gain
+typedef struct
+{
+    float *x;
+    float *y;
+    float *vx;
+    float *vy;
+} scalar_world;
+
+static double now_ms(void);
+static float  random_between(unsigned *seed, float lo, float hi);
+static int    fill(entity_world *world, scalar_world *ref, size_t count);
+static void   scalar_step(scalar_world *ref, size_t count, float dt);
+static size_t scalar_collide(const scalar_world *ref, size_t count, float px, float py, float radius, size_t *hits, size_t max_hits);
+static int    run_case(size_t count, long frames);
+
+// Ticks worlds of increasing size for a number of frames, moving every entity and testing it against
+// both players each frame, and reports the cost per frame against a 60 fps budget
+int main(int argc, char *argv[])
+{
+    static const size_t counts[] = {1000, 10000, 100000, 250000, 1000000};
+    long                frames   = DEFAULT_FRAMES;
+
+    if(argc > 1)
+    {
+        frames = strtol(argv[1], NULL, 10);    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+        if(frames <= 0)
+        {
+            fprintf(stderr, "Usage: %s [frames]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    printf("%10s %14s %14s %9s %8s\n", "entities", "vector ms/fr", "scalar ms/fr", "speedup", "budget");
+    for(size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++)
+    {
+        if(run_case(counts[i], frames) != 0)
+        {
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+static double now_ms(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec * MILLIS_PER_SEC + (double)now.tv_nsec / NANOS_PER_MILLI;
+}
+
+static float random_between(unsigned *seed, float lo, float hi)
+{
+    int value = rand_r(seed);
+
+    return lo + (hi - lo) * ((float)value / (float)RAND_MAX);
+}
+
+// A third of each kind; pickups sit still, projectiles and hazards move in random directions
+static int fill(entity_world *world, scalar_world *ref, size_t count)
+{
+    unsigned seed = 1;
+
+    if(entity_world_init(world, count, BOARD_MIN, BOARD_MIN, BOARD_MAX, BOARD_MAX) != 0)
+    {
+        return -1;
+    }
+    ref->x  = (float *)malloc(count * sizeof(float));
+    ref->y  = (float *)malloc(count * sizeof(float));
+    ref->vx = (float *)malloc(count * sizeof(float));
+    ref->vy = (float *)malloc(count * sizeof(float));
+    if(ref->x == NULL || ref->y == NULL || ref->vx == NULL || ref->vy == NULL)
+    {
+        perror("malloc");
+        return -1;
+    }
+    for(size_t i = 0; i < count; i++)
+    {
+        uint8_t kind  = (uint8_t)(i % ENTITY_KINDS);
+        float   speed = kind == ENTITY_PICKUP ? 0.0F : MAX_SPEED;
+
+        ref->x[i]  = random_between(&seed, BOARD_MIN, BOARD_MAX);
+        ref->y[i]  = random_between(&seed, BOARD_MIN, BOARD_MAX);
+        ref->vx[i] = random_between(&seed, -speed, speed);
+        ref->vy[i] = random_between(&seed, -speed, speed);
+        entity_spawn(world, kind, ref->x[i], ref->y[i], ref->vx[i], ref->vy[i]);
+    }
+    return 0;
+}
+
+static void scalar_step(scalar_world *ref, size_t count, float dt)
+{
+    for(size_t i = 0; i < count; i++)
+    {
+        ref->x[i] += ref->vx[i] * dt;
+        ref->y[i] += ref->vy[i] * dt;
+        if(ref->x[i] < BOARD_MIN)
+        {
+            ref->x[i]  = BOARD_MIN;
+            ref->vx[i] = -ref->vx[i];
+        }
+        else if(ref->x[i] > BOARD_MAX)
+        {
+            ref->x[i]  = BOARD_MAX;
+            ref->vx[i] = -ref->vx[i];
+        }
+        if(ref->y[i] < BOARD_MIN)
+        {
+            ref->y[i]  = BOARD_MIN;
+            ref->vy[i] = -ref->vy[i];
+        }
+        else if(ref->y[i] > BOARD_MAX)
+        {
+            ref->y[i]  = BOARD_MAX;
+            ref->vy[i] = -ref->vy[i];
+        }
+    }
+}
+
+static size_t scalar_collide(const scalar_world *ref, size_t count, float px, float py, float radius, size_t *hits, size_t max_hits)
+{
+    size_t found = 0;
+
+    for(size_t i = 0; i < count; i++)
+    {
+        float dx = ref->x[i] - px;
+        float dy = ref->y[i] - py;
+
+        if(dx * dx + dy * dy <= radius * radius)
+        {
+            if(found < max_hits)
+            {
+                hits[found] = i;
+            }
+            found++;
+        }
+    }
+    return found;
+}
+
+static int run_case(size_t count, long frames)
+{
+    static const float players[PLAYERS][2] = {
+        {5.0F,  5.0F },
+        {30.0F, 20.0F},
+    };
+    entity_world world;
+    scalar_world ref = {NULL, NULL, NULL, NULL};
+    size_t      *hits;
+    size_t       vector_hits = 0;
+    size_t       scalar_hits = 0;
+    double       start;
+    double       vector_ms;
+    double       scalar_ms;
+    int          ret = -1;
+
+    memset(&world, 0, sizeof(world));
+    hits = (size_t *)malloc(MAX_HITS * sizeof(size_t));
+    if(hits == NULL || fill(&world, &ref, count) != 0)
+    {
+        perror("run_case");
+        goto done;
+    }
+
+    start = now_ms();
+    for(long f = 0; f < frames; f++)
+    {
+        entity_step(&world, FRAME_DT);
+        for(int p = 0; p < PLAYERS; p++)
+        {
+            vector_hits += entity_collide(&world, players[p][0], players[p][1], PLAYER_RADIUS, hits, MAX_HITS);
+        }
+    }
+    vector_ms = (now_ms() - start) / (double)frames;
+
+    start = now_ms();
+    for(long f = 0; f < frames; f++)
+    {
+        scalar_step(&ref, count, FRAME_DT);
+        for(int p = 0; p < PLAYERS; p++)
+        {
+            scalar_hits += scalar_collide(&ref, count, players[p][0], players[p][1], PLAYER_RADIUS, hits, MAX_HITS);
+        }
+    }
+    scalar_ms = (now_ms() - start) / (double)frames;
+
+    // Both ran the same arithmetic, so they may only differ by rounding
+    for(size_t i = 0; i < count; i++)
+    {
+        float dx = world.x[i] - ref.x[i];
+        float dy = world.y[i] - ref.y[i];
+
+        if(dx > TOLERANCE || dx < -TOLERANCE || dy > TOLERANCE || dy < -TOLERANCE)
+        {
+            fprintf(stderr, "entity %zu diverged: (%f, %f) vs (%f, %f)\n", i, (double)world.x[i], (double)world.y[i], (double)ref.x[i], (double)ref.y[i]);
+            goto done;
+        }
+    }
+
+    printf("%10zu %14.3f %14.3f %8.1fx %8s", count, vector_ms, scalar_ms, scalar_ms / vector_ms, vector_ms < FRAME_BUDGET_MS ? "ok" : "OVER");
+    if(vector_hits != scalar_hits)
+    {
+        printf("    (hits differ by rounding: %zu vs %zu)", vector_hits, scalar_hits);
+    }
+    printf("\n");
+    ret = 0;
+
+done:
+    entity_world_destroy(&world);
+    free(ref.x);
+    free(ref.y);
+    free(ref.vx);
+    free(ref.vy);
+    free(hits);
+    return ret;
+}
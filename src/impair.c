@@ -0,0 +1,521 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PACKET_MAX 512
+#define QUEUE_MAX 4096
+#define PERCENT 100.0
+#define MILLIS_PER_SEC 1000
+#define NANOS_PER_MILLI 1000000L
+#define DEFAULT_REORDER_HOLD 20
+#define UNKNOWN_OPTION_MESSAGE_LEN 24
+
+// A datagram waiting for its delivery time
+typedef struct
+{
+    int64_t  due_ms;
+    uint64_t order;    // arrival order, so datagrams due in the same millisecond keep it
+    int      side;
+    size_t   len;
+    uint8_t  buf[PACKET_MAX];
+} pending_packet;
+
+// Impairment settings, applied the same way in both directions
+typedef struct
+{
+    double loss;
+    double duplicate;
+    double reorder;
+    int    delay_ms;
+    int    jitter_ms;
+    int    reorder_hold_ms;
+} impairment;
+
+// Per-direction counters, printed on exit
+typedef struct
+{
+    uint64_t received;
+    uint64_t forwarded;
+    uint64_t dropped;
+    uint64_t duplicated;
+    uint64_t reordered;
+    uint64_t overflowed;
+} direction_stats;
+
+// One side faces a game instance: it is what that instance's -r/-o points at, and it forwards to the other instance
+typedef struct
+{
+    int                     sock;
+    struct sockaddr_storage peer_addr;
+    socklen_t               peer_addr_len;
+    direction_stats         stats;
+} proxy_side;
+
+static void             parse_arguments(int argc, char *argv[], const char **ip, in_port_t ports[4], impairment *imp, uint64_t *seed);
+_Noreturn static void   usage(const char *program_name, int exit_code, const char *message);
+static in_port_t        parse_port(const char *program_name, const char *str);
+static double           parse_percent(const char *program_name, const char *str);
+static int              parse_millis(const char *program_name, const char *str);
+static void             setup_signal_handler(void);
+static void             sigint_handler(int signum);
+static int              bind_side(proxy_side *side, const char *ip, in_port_t listen_port, in_port_t peer_port);
+static int64_t          now_ms(void);
+static double           next_random(uint64_t *state);
+static void             schedule(pending_packet *pending, size_t *count, const pending_packet *packet, direction_stats *stats);
+static void             heap_pop(pending_packet *pending, size_t *count);
+static bool             due_before(const pending_packet *a, const pending_packet *b);
+static void             receive_side(proxy_side sides[2], int from, const impairment *imp, uint64_t *rng, pending_packet *pending, size_t *count);
+static void             print_stats(const proxy_side sides[2]);
+
+static volatile sig_atomic_t exit_flag = 0;    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+
+static pending_packet pending_queue[QUEUE_MAX];    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+
+// A local stand-in for a bad WAN between two game instances.
+// Instance A talks to -a, instance B talks to -b; datagrams from A leave through the -b socket so B sees them
+// coming from the address it was told about, and vice versa.
+int main(int argc, char *argv[])
+{
+    const char *ip;
+    in_port_t   ports[4];
+    impairment  imp;
+    uint64_t    rng;
+    proxy_side  sides[2];
+    size_t      count = 0;
+
+    parse_arguments(argc, argv, &ip, ports, &imp, &rng);
+    setup_signal_handler();
+    memset(sides, 0, sizeof(sides));
+    if(bind_side(&sides[0], ip, ports[0], ports[2]) < 0 || bind_side(&sides[1], ip, ports[1], ports[3]) < 0)
+    {
+        return EXIT_FAILURE;
+    }
+    printf("Forwarding %s:%u <-> %s:%u via %u/%u: loss %.1f%% delay %dms jitter %dms reorder %.1f%% duplicate %.1f%%\n", ip, ports[2], ip, ports[3], ports[0], ports[1], imp.loss * PERCENT, imp.delay_ms, imp.jitter_ms, imp.reorder * PERCENT, imp.duplicate * PERCENT);
+    fflush(stdout);
+
+    while(!exit_flag)
+    {
+        struct pollfd fds[2];
+        int           timeout = -1;
+        int64_t       now;
+
+        now = now_ms();
+        while(count > 0 && pending_queue[0].due_ms <= now)
+        {
+            proxy_side *out = &sides[1 - pending_queue[0].side];
+
+            if(sendto(out->sock, pending_queue[0].buf, pending_queue[0].len, 0, (struct sockaddr *)&out->peer_addr, out->peer_addr_len) >= 0)
+            {
+                sides[pending_queue[0].side].stats.forwarded++;
+            }
+            heap_pop(pending_queue, &count);
+        }
+        if(count > 0)
+        {
+            timeout = (int)(pending_queue[0].due_ms - now);
+        }
+
+        fds[0].fd     = sides[0].sock;
+        fds[0].events = POLLIN;
+        fds[1].fd     = sides[1].sock;
+        fds[1].events = POLLIN;
+        if(poll(fds, 2, timeout) < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            perror("poll");
+            break;
+        }
+        for(int i = 0; i < 2; i++)
+        {
+            if(fds[i].revents & POLLIN)
+            {
+                receive_side(sides, i, &imp, &rng, pending_queue, &count);
+            }
+        }
+    }
+
+    print_stats(sides);
+    close(sides[0].sock);
+    close(sides[1].sock);
+    return EXIT_SUCCESS;
+}
+
+static void parse_arguments(int argc, char *argv[], const char **ip, in_port_t ports[4], impairment *imp, uint64_t *seed)
+{
+    int opt;
+
+    *ip = NULL;
+    memset(ports, 0, 4 * sizeof(in_port_t));
+    memset(imp, 0, sizeof(*imp));
+    imp->reorder_hold_ms = DEFAULT_REORDER_HOLD;
+    *seed                = (uint64_t)time(NULL);
+    opterr               = 0;
+    while((opt = getopt(argc, argv, "hi:a:b:A:B:L:d:j:R:H:D:s:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'i':
+            {
+                *ip = optarg;
+                break;
+            }
+            case 'a':
+            {
+                ports[0] = parse_port(argv[0], optarg);
+                break;
+            }
+            case 'b':
+            {
+                ports[1] = parse_port(argv[0], optarg);
+                break;
+            }
+            case 'A':
+            {
+                ports[2] = parse_port(argv[0], optarg);
+                break;
+            }
+            case 'B':
+            {
+                ports[3] = parse_port(argv[0], optarg);
+                break;
+            }
+            case 'L':
+            {
+                imp->loss = parse_percent(argv[0], optarg);
+                break;
+            }
+            case 'd':
+            {
+                imp->delay_ms = parse_millis(argv[0], optarg);
+                break;
+            }
+            case 'j':
+            {
+                imp->jitter_ms = parse_millis(argv[0], optarg);
+                break;
+            }
+            case 'R':
+            {
+                imp->reorder = parse_percent(argv[0], optarg);
+                break;
+            }
+            case 'H':
+            {
+                imp->reorder_hold_ms = parse_millis(argv[0], optarg);
+                break;
+            }
+            case 'D':
+            {
+                imp->duplicate = parse_percent(argv[0], optarg);
+                break;
+            }
+            case 's':
+            {
+                *seed = strtoull(optarg, NULL, 10);    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+                break;
+            }
+            case 'h':
+            {
+                usage(argv[0], EXIT_SUCCESS, NULL);
+            }
+            case '?':
+            {
+                char message[UNKNOWN_OPTION_MESSAGE_LEN];
+
+                snprintf(message, sizeof(message), "Unknown option '-%c'.", optopt);
+                usage(argv[0], EXIT_FAILURE, message);
+            }
+            default:
+            {
+                usage(argv[0], EXIT_FAILURE, NULL);
+            }
+        }
+    }
+    if(*ip == NULL || ports[0] == 0 || ports[1] == 0 || ports[2] == 0 || ports[3] == 0)
+    {
+        usage(argv[0], EXIT_FAILURE, "The IP and all four ports are required.");
+    }
+    if(optind < argc)
+    {
+        usage(argv[0], EXIT_FAILURE, "Too many arguments.");
+    }
+    if(*seed == 0)
+    {
+        *seed = 1;
+    }
+}
+
+_Noreturn static void usage(const char *program_name, int exit_code, const char *message)
+{
+    if(message)
+    {
+        fprintf(stderr, "%s\n", message);
+    }
+
+    fprintf(stderr, "Usage: %s -i <ip> -a <port for A> -b <port for B> -A <A's port> -B <B's port> [-L loss%%] [-d delay ms] [-j jitter ms] [-R reorder%%] [-H reorder hold ms] [-D duplicate%%] [-s seed] [-h]\n", program_name);
+    fputs("Options:\n", stderr);
+    fputs("  -h   Display this help message\n", stderr);
+    fputs("  -a   Port instance A sends to (its -o)\n", stderr);
+    fputs("  -b   Port instance B sends to (its -o)\n", stderr);
+    fputs("  -A   Port instance A listens on (its -p)\n", stderr);
+    fputs("  -B   Port instance B listens on (its -p)\n", stderr);
+    fputs("  -L   Percentage of datagrams to drop\n", stderr);
+    fputs("  -d   Base one-way delay\n", stderr);
+    fputs("  -j   Delay varies uniformly by up to this much either way\n", stderr);
+    fputs("  -R   Percentage of datagrams held back so later ones overtake them\n", stderr);
+    fputs("  -H   How long a reordered datagram is held back (default 20)\n", stderr);
+    fputs("  -D   Percentage of datagrams delivered twice\n", stderr);
+    fputs("  -s   Random seed, for repeatable runs\n", stderr);
+    exit(exit_code);
+}
+
+static in_port_t parse_port(const char *program_name, const char *str)
+{
+    char *endptr;
+    long  val;
+
+    errno = 0;
+    val   = strtol(str, &endptr, 10);    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    if(endptr == str || *endptr != '\0' || errno != 0 || val <= 0 || val > UINT16_MAX)
+    {
+        usage(program_name, EXIT_FAILURE, "Invalid port.");
+    }
+    return (in_port_t)val;
+}
+
+static double parse_percent(const char *program_name, const char *str)
+{
+    char  *endptr;
+    double val;
+
+    val = strtod(str, &endptr);
+    if(endptr == str || *endptr != '\0' || val < 0 || val > PERCENT)
+    {
+        usage(program_name, EXIT_FAILURE, "Percentages must be between 0 and 100.");
+    }
+    return val / PERCENT;
+}
+
+static int parse_millis(const char *program_name, const char *str)
+{
+    char *endptr;
+    long  val;
+
+    errno = 0;
+    val   = strtol(str, &endptr, 10);    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    if(endptr == str || *endptr != '\0' || errno != 0 || val < 0 || val > INT16_MAX)
+    {
+        usage(program_name, EXIT_FAILURE, "Invalid number of milliseconds.");
+    }
+    return (int)val;
+}
+
+static void setup_signal_handler(void)
+{
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+#if defined(__clang__)
+    #pragma clang diagnostic push
+    #pragma clang diagnostic ignored "-Wdisabled-macro-expansion"
+#endif
+    sa.sa_handler = sigint_handler;
+#if defined(__clang__)
+    #pragma clang diagnostic pop
+#endif
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+
+static void sigint_handler(int signum)
+{
+    exit_flag = 1;
+}
+
+#pragma GCC diagnostic pop
+
+static int bind_side(proxy_side *side, const char *ip, in_port_t listen_port, in_port_t peer_port)
+{
+    struct sockaddr_in  listen_addr;
+    struct sockaddr_in *peer_addr = (struct sockaddr_in *)&side->peer_addr;
+
+    memset(&listen_addr, 0, sizeof(listen_addr));
+    listen_addr.sin_family = AF_INET;
+    listen_addr.sin_port   = htons(listen_port);
+    if(inet_pton(AF_INET, ip, &listen_addr.sin_addr) != 1)
+    {
+        fprintf(stderr, "%s is not an IPv4 address\n", ip);
+        return -1;
+    }
+    peer_addr->sin_family = AF_INET;
+    peer_addr->sin_port   = htons(peer_port);
+    peer_addr->sin_addr   = listen_addr.sin_addr;
+    side->peer_addr_len   = sizeof(*peer_addr);
+
+    side->sock = socket(AF_INET, SOCK_DGRAM, 0);    // NOLINT(android-cloexec-socket)
+    if(side->sock < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+    if(bind(side->sock, (struct sockaddr *)&listen_addr, sizeof(listen_addr)) < 0)
+    {
+        perror("bind");
+        close(side->sock);
+        return -1;
+    }
+    return 0;
+}
+
+static int64_t now_ms(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * MILLIS_PER_SEC + now.tv_nsec / NANOS_PER_MILLI;
+}
+
+// xorshift64*, so a given seed replays the same impairments
+static double next_random(uint64_t *state)
+{
+    *state ^= *state >> 12;                                        // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    *state ^= *state << 25;                                        // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    *state ^= *state >> 27;                                        // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    return (double)((*state * 2685821657736338717ULL) >> 11) / 9007199254740992.0;    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+}
+
+// The queue is a min-heap on delivery time, then arrival. A heap alone is not stable, so without the
+// arrival order datagrams due in the same millisecond would come out shuffled even with no -R.
+static void schedule(pending_packet *pending, size_t *count, const pending_packet *packet, direction_stats *stats)
+{
+    static uint64_t next_order = 0;    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+    pending_packet  entry;
+    size_t          child;
+
+    if(*count == QUEUE_MAX)
+    {
+        stats->overflowed++;
+        return;
+    }
+    entry       = *packet;
+    entry.order = next_order++;
+    child       = (*count)++;
+    while(child > 0 && due_before(&entry, &pending[(child - 1) / 2]))
+    {
+        pending[child] = pending[(child - 1) / 2];
+        child          = (child - 1) / 2;
+    }
+    pending[child] = entry;
+}
+
+static void heap_pop(pending_packet *pending, size_t *count)
+{
+    pending_packet last;
+    size_t         parent = 0;
+
+    last = pending[--(*count)];
+    for(;;)
+    {
+        size_t child = parent * 2 + 1;
+
+        if(child >= *count)
+        {
+            break;
+        }
+        if(child + 1 < *count && due_before(&pending[child + 1], &pending[child]))
+        {
+            child++;
+        }
+        if(!due_before(&pending[child], &last))
+        {
+            break;
+        }
+        pending[parent] = pending[child];
+        parent          = child;
+    }
+    pending[parent] = last;
+}
+
+static bool due_before(const pending_packet *a, const pending_packet *b)
+{
+    return a->due_ms < b->due_ms || (a->due_ms == b->due_ms && a->order < b->order);
+}
+
+static void receive_side(proxy_side sides[2], int from, const impairment *imp, uint64_t *rng, pending_packet *pending, size_t *count)
+{
+    proxy_side    *side = &sides[from];
+    pending_packet packet;
+    ssize_t        bytes;
+    int            copies = 1;
+
+    bytes = recvfrom(side->sock, packet.buf, sizeof(packet.buf), 0, NULL, NULL);
+    if(bytes < 0)
+    {
+        return;
+    }
+    side->stats.received++;
+    packet.len  = (size_t)bytes;
+    packet.side = from;
+
+    if(next_random(rng) < imp->loss)
+    {
+        side->stats.dropped++;
+        return;
+    }
+    if(next_random(rng) < imp->duplicate)
+    {
+        side->stats.duplicated++;
+        copies = 2;
+    }
+    for(int i = 0; i < copies; i++)
+    {
+        int64_t delay = imp->delay_ms;
+
+        if(imp->jitter_ms > 0)
+        {
+            delay += (int64_t)((next_random(rng) * 2.0 - 1.0) * imp->jitter_ms);
+        }
+        if(next_random(rng) < imp->reorder)
+        {
+            side->stats.reordered++;
+            delay += imp->reorder_hold_ms;
+        }
+        packet.due_ms = now_ms() + (delay > 0 ? delay : 0);
+        schedule(pending, count, &packet, &side->stats);
+    }
+}
+
+static void print_stats(const proxy_side sides[2])
+{
+    static const char *const names[2] = {"A->B", "B->A"};
+
+    printf("%-6s %10s %10s %10s %10s %10s %10s\n", "dir", "received", "forwarded", "dropped", "duplicated", "reordered", "overflowed");
+    for(int i = 0; i < 2; i++)
+    {
+        const direction_stats *stats = &sides[i].stats;
+
+        printf("%-6s %10llu %10llu %10llu %10llu %10llu %10llu\n",
+               names[i],
+               (unsigned long long)stats->received,
+               (unsigned long long)stats->forwarded,
+               (unsigned long long)stats->dropped,
+               (unsigned long long)stats->duplicated,
+               (unsigned long long)stats->reordered,
+               (unsigned long long)stats->overflowed);
+    }
+}
@@ -13,21 +13,37 @@
 #ifdef __clang__
     #pragma clang diagnostic pop
 #endif
+#if defined(__linux__) || (defined(__APPLE__) && defined(__MACH__))
+    #include "sdl_render.h"
+#endif
 #ifdef __linux__
     #include <fcntl.h>
     #include <linux/input-event-codes.h>
     #include <linux/input.h>
 #endif
+#include "metrics.h"
+#include "net_backend.h"
+#include "peer_filter.h"
+#include "rollback.h"
+#include "send_scheduler.h"
+#include "spectate.h"
+#include "spsc.h"
+#include "state_export.h"
+#include "sync.h"
 #include <arpa/inet.h>
+#include <errno.h>
 #include <ncurses.h>
 #include <netinet/in.h>
 #include <p101_fsm/fsm.h>
 #include <p101_posix/p101_unistd.h>
+#include <poll.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <time.h>
 #include <unistd.h>
 
 #define LINES 40
@@ -35,6 +51,19 @@
 #define ONE 1
 #define ZERO 0
 #define TIMER_DELAY 5
+#define MILLIS_PER_SEC 1000
+#define NANOS_PER_MILLI 1000000L
+#define NANOS_PER_MICRO 1000L
+#define MICROS_PER_SEC 1000000L
+#define MICROS_PER_MILLI 1000
+#define DEFAULT_PEER_RATE 200
+#define PEER_BURST_DIVISOR 4
+#define MIN_PEER_BURST 8
+#define DEFAULT_SEND_RATE 30
+#define DEFAULT_INPUT_DELAY 2
+#define INVALID_MOVE_MS 1000
+#define TILE_PX 16
+#define FRAMES_PER_SEC 60
 #define UNKNOWN_OPTION_MESSAGE_LEN 24
 #define UP 1
 #define RIGHT 2
@@ -46,6 +75,66 @@
 #define ERR_OUT_OF_RANGE 2
 #define ERR_INVALID_CHARS 3
 #define EXIT_CODE 1
+#define INPUT_KEY 1
+#define INPUT_QUIT 2
+#define INPUT_RING 64
+#define NET_RING 256
+#define RENDER_RING 16
+#define NET_THREAD_IDLE_MS 1000
+#define BOARD_STATE 4
+
+_Static_assert(ROLLBACK_MSG_MAX <= SYNC_PACKET_MAX, "input messages travel in the same buffers as sync messages");
+
+// A key press handed from the input thread to the simulation
+typedef struct
+{
+    int     kind;
+    int     direction;
+    int64_t noticed_us;
+} input_record;
+
+// A datagram handed between the network thread and the simulation; len 0 from the network thread means it failed
+typedef struct
+{
+    struct sockaddr_storage from;
+    size_t                  len;
+    int64_t                 received_us;
+    uint8_t                 bytes[SYNC_PACKET_MAX];
+} net_event;
+
+// Everything the render thread needs to draw the board once
+typedef struct
+{
+    int  local_x;
+    int  local_y;
+    int  remote_x;
+    int  remote_y;
+    bool invalid_move;
+} render_frame;
+
+// With -t, network I/O, keyboard input and terminal output each get their own thread and the FSM
+// thread only simulates. Records go between them through SPSC rings, with no locks.
+typedef struct
+{
+    spsc_ring      input;       // input thread -> simulation
+    spsc_ring      inbound;     // network thread -> simulation
+    spsc_ring      outbound;    // simulation -> network thread
+    spsc_ring      render;      // simulation -> render thread
+    spsc_doorbell  sim_bell;
+    spsc_doorbell  net_bell;
+    spsc_doorbell  input_bell;
+    spsc_doorbell  render_bell;
+    pthread_t      net_thread;
+    pthread_t      input_thread;
+    pthread_t      render_thread;
+    int            threads;
+    atomic_bool    stop;
+    bool           ready;
+    metrics_shard *metrics;    // the network thread's
+    uint64_t       dropped_input;
+    uint64_t       dropped_inbound;
+    uint64_t       dropped_outbound;
+} thread_pipeline;
 
 typedef struct
 {
@@ -59,13 +148,49 @@ typedef struct
     int     remote_x;
 #if defined(__linux__) || (defined(__APPLE__) && defined(__MACH__))
     SDL_GameController *controller;
+    sdl_renderer        sdl;
+    uint8_t             drawn[4];
 #endif
-    int       local_udp_socket;
-    uint16_t  received_value;
-    uint16_t  send_value;
-    int       direction;
-    in_port_t local_port;
-    in_port_t remote_port;
+    bool                    graphical;
+    int                     local_udp_socket;
+    uint16_t                received_value;
+    uint16_t                send_value;
+    int                     direction;
+    in_port_t               local_port;
+    in_port_t               remote_port;
+    struct sockaddr_storage remote_addr;
+    socklen_t               remote_addr_len;
+    sync_state              sync;
+    bool                    joining;    // our join is unanswered, so the next snapshot may say where we were
+    uint8_t                 packet[SYNC_PACKET_MAX];
+    size_t                  packet_len;
+    int                     backend;
+    net_backend             net;
+    uint32_t                peer_rate;
+    peer_filter             filter;
+    char                   *spectate_group;
+    in_port_t               spectate_port;
+    spectate_publisher      spectate;
+    bool                    threaded;
+    thread_pipeline         pipeline;
+    in_port_t               metrics_port;
+    char                   *metrics_path;
+    metrics_registry        metrics;
+    metrics_shard          *fsm_metrics;
+    int64_t                 noticed_us;
+    int64_t                 sent_at_us[SYNC_HISTORY];
+    uint32_t                send_rate;
+    send_scheduler          sched;
+    bool                    rollback_mode;
+    uint32_t                input_delay;
+    rollback_session        rollback;
+    uint8_t                 sim[BOARD_STATE];    // the board as the rollback session steps it, laid out as pack_state() does
+    uint8_t                 pending_input;       // the move to hand to the next frame
+    int64_t                 next_frame_us;
+    int64_t                 idle_deadline;       // when the timer move is due, kept across frames
+    int64_t                 invalid_until_ms;    // rollback mode redraws every frame, so the message is held until then
+    char                   *export_name;
+    state_export            shared_state;
 } program_data;
 
 enum application_states
@@ -77,12 +202,20 @@ enum application_states
     PROCESS_TIMER_MOVE,
     MOVE_LOCAL,
     MOVE_REMOTE,
+    APPLY_SYNC,
+    ADVANCE_FRAME,
+    APPLY_INPUTS,
     ERROR
 };
 
+// Metric labels for the states above, starting from SETUP
+static const char *const state_names[] = {"setup", "wait_for_input", "process_keyboard_input", "process_controller_input", "process_timer_move", "move_local", "move_remote", "apply_sync", "advance_frame", "apply_inputs", "error"};
+
 static void             parse_arguments(const struct p101_env *env, int argc, char *argv[], bool *bad, bool *will, bool *did, program_data *data, int *err);
 _Noreturn static void   usage(const char *program_name, int exit_code, const char *message);
 in_port_t               convert_port(const char *str, int *err);
+uint32_t                convert_rate(const char *str, int *err);
+uint32_t                convert_delay(const char *str, int *err);
 static void             setup_signal_handler(void);
 static void             sigint_handler(int signum);
 void                    setup_network_address(struct sockaddr_storage *addr, socklen_t *addr_len, const char *address, in_port_t port, int *err);
@@ -93,9 +226,34 @@ static p101_fsm_state_t process_keyboard_input(const struct p101_env *env, struc
 static p101_fsm_state_t process_timer_move(const struct p101_env *env, struct p101_error *err, void *arg);
 static p101_fsm_state_t move_local(const struct p101_env *env, struct p101_error *err, void *arg);
 static p101_fsm_state_t move_remote(const struct p101_env *env, struct p101_error *err, void *arg);
+static p101_fsm_state_t apply_sync(const struct p101_env *env, struct p101_error *err, void *arg);
+static p101_fsm_state_t advance_frame(const struct p101_env *env, struct p101_error *err, void *arg);
+static p101_fsm_state_t apply_inputs(const struct p101_env *env, struct p101_error *err, void *arg);
 static p101_fsm_state_t state_error(const struct p101_env *env, struct p101_error *err, void *arg);
 int                     process_direction(program_data *data);
-static void             send_udp_packet(const char *remote_ip, in_port_t remote_port, uint16_t send_value);
+static void             send_udp_packet(program_data *data, const uint8_t *buf, size_t len);
+static size_t           pack_state(const program_data *data, uint8_t *state);
+static bool             accept_packet(program_data *data, const uint8_t *buf, const struct sockaddr_storage *from, size_t len);
+static bool             on_board(int x, int y);
+static int64_t          monotonic_ms(void);
+static int64_t          monotonic_us(void);
+static void             note_sent(program_data *data);
+static void             flush_moves(program_data *data);
+static void             draw_board(program_data *data);
+static void             publish_spectators(program_data *data);
+static void             export_state(program_data *data);
+static void             step_players(void *ctx, uint8_t *sim, const uint8_t *inputs);
+static void             queue_input(program_data *data);
+static int              frame_timeout(const program_data *data, int timeout_ms);
+static int              key_direction(const char *buffer, ssize_t len);
+static p101_fsm_state_t route_packet(program_data *data, size_t len);
+static p101_fsm_state_t wait_threaded(program_data *data, int64_t deadline);
+static int              pipeline_start(program_data *data);
+static void             pipeline_stop(program_data *data);
+static void            *net_thread(void *arg);
+static void            *input_thread(void *arg);
+static void            *render_thread(void *arg);
+static void             draw_frame(WINDOW *win, const render_frame *frame);
 void                    cleanup(program_data *data);
 
 static volatile sig_atomic_t exit_flag = 0;    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
@@ -118,14 +276,18 @@ int main(int argc, char *argv[])
     bad   = false;
     will  = false;
     did   = false;
+    memset(&data, 0, sizeof(data));
     setup_signal_handler();
     parse_arguments(env, argc, argv, &bad, &will, &did, &data, &err);
     if(err != 0)
     {
-        perror("port");
+        // Only -p and -o are left to report here; the other numeric options exit from parse_arguments
+        fputs("Invalid port number.\n", stderr);
         return -1;
     }
     printf("Dest IP address: %s\n", data.remote_ip);
+    metrics_init(&data.metrics, state_names, ERROR - SETUP + 1);
+    data.fsm_metrics = metrics_register(&data.metrics);
     fsm_error = p101_error_create(false);
     fsm_env   = p101_env_create(error, true, NULL);
     fsm       = p101_fsm_info_create(env, error, "test-fsm", fsm_env, fsm_error, NULL);
@@ -142,18 +304,27 @@ int main(int argc, char *argv[])
             {WAIT_FOR_INPUT,         PROCESS_KEYBOARD_INPUT, process_keyboard_input},
             {WAIT_FOR_INPUT,         PROCESS_TIMER_MOVE,     process_timer_move    },
             {WAIT_FOR_INPUT,         MOVE_REMOTE,            move_remote           },
+            {WAIT_FOR_INPUT,         APPLY_SYNC,             apply_sync            },
+            {WAIT_FOR_INPUT,         ADVANCE_FRAME,          advance_frame         },
+            {WAIT_FOR_INPUT,         APPLY_INPUTS,           apply_inputs          },
             {PROCESS_KEYBOARD_INPUT, MOVE_LOCAL,             move_local            },
             {PROCESS_TIMER_MOVE,     MOVE_LOCAL,             move_local            },
             {PROCESS_KEYBOARD_INPUT, WAIT_FOR_INPUT,         wait_for_input        }, //  if validation fails
             {PROCESS_TIMER_MOVE,     WAIT_FOR_INPUT,         wait_for_input        }, //  if validation fails
             {MOVE_LOCAL,             WAIT_FOR_INPUT,         wait_for_input        },
             {MOVE_REMOTE,            WAIT_FOR_INPUT,         wait_for_input        },
+            {APPLY_SYNC,             WAIT_FOR_INPUT,         wait_for_input        },
+            {ADVANCE_FRAME,          WAIT_FOR_INPUT,         wait_for_input        },
+            {APPLY_INPUTS,           WAIT_FOR_INPUT,         wait_for_input        },
             {SETUP,                  ERROR,                  state_error           },
             {WAIT_FOR_INPUT,         ERROR,                  state_error           },
             {PROCESS_KEYBOARD_INPUT, ERROR,                  state_error           },
             {PROCESS_TIMER_MOVE,     ERROR,                  state_error           },
             {MOVE_LOCAL,             ERROR,                  state_error           },
             {MOVE_REMOTE,            ERROR,                  state_error           },
+            {APPLY_SYNC,             ERROR,                  state_error           },
+            {ADVANCE_FRAME,          ERROR,                  state_error           },
+            {APPLY_INPUTS,           ERROR,                  state_error           },
             {WAIT_FOR_INPUT,         P101_FSM_EXIT,          NULL                  }, //  if we ask to exit (cntrl c?)
             {ERROR,                  P101_FSM_EXIT,          NULL                  }
         };
@@ -163,10 +334,43 @@ int main(int argc, char *argv[])
         p101_fsm_info_destroy(env, &fsm);
     }
 
+    // The render thread must be gone before ncurses is torn down
+    pipeline_stop(&data);
+    // Leaves the metrics file with the final counts
+    metrics_export_stop(&data.metrics);
+
     // Restore the cursor before exiting
     curs_set(1);
     // deallocates memory and ends ncurses
     endwin();
+    printf("Datagrams accepted: %llu, dropped: %llu unknown sender, %llu over rate, %llu malformed\n",
+           (unsigned long long)data.filter.counters.accepted,
+           (unsigned long long)data.filter.counters.dropped_unknown,
+           (unsigned long long)data.filter.counters.dropped_rate,
+           (unsigned long long)data.filter.counters.dropped_malformed);
+    if(data.threaded)
+    {
+        printf("Pipeline records dropped: %llu input, %llu inbound, %llu outbound\n",
+               (unsigned long long)data.pipeline.dropped_input,
+               (unsigned long long)data.pipeline.dropped_inbound,
+               (unsigned long long)data.pipeline.dropped_outbound);
+    }
+    printf("Move updates sent: %llu, moves combined into them: %llu\n", (unsigned long long)data.sched.sent, (unsigned long long)data.sched.coalesced);
+    if(data.spectate_group != NULL)
+    {
+        printf("Spectator datagrams: %llu sent, %llu failed\n", (unsigned long long)data.spectate.sent, (unsigned long long)data.spectate.errors);
+    }
+    if(data.rollback_mode)
+    {
+        printf("Rollback frames: %lu run, %llu rollbacks re-running %llu frames (deepest %lu), %llu mispredicted inputs, %llu stalls\n",
+               (unsigned long)data.rollback.frame,
+               (unsigned long long)data.rollback.rollbacks,
+               (unsigned long long)data.rollback.resimulated,
+               (unsigned long)data.rollback.deepest,
+               (unsigned long long)data.rollback.mispredictions,
+               (unsigned long long)data.rollback.stalls);
+        rollback_destroy(&data.rollback);
+    }
     free(fsm_env);
     free(env);
     p101_error_reset(error);
@@ -181,13 +385,24 @@ int main(int argc, char *argv[])
 // Parse the command line arguments
 static void parse_arguments(const struct p101_env *env, int argc, char *argv[], bool *bad, bool *will, bool *did, program_data *data, int *err)
 {
-    int opt;
+    int  opt;
+    bool delay_given = false;
     data->remote_ip   = NULL;
     data->local_ip    = NULL;
     data->local_port  = 0;
     data->remote_port = 0;
-    opterr            = 0;
-    while((opt = p101_getopt(env, argc, argv, "hbdwr:l:o:p:")) != -1)
+    data->backend     = NET_BACKEND_CLASSIC;
+    data->peer_rate      = DEFAULT_PEER_RATE;
+    data->spectate_group = NULL;
+    data->spectate_port  = 0;
+    data->spectate.sock  = -1;
+    data->metrics_port   = 0;
+    data->metrics_path   = NULL;
+    data->send_rate      = DEFAULT_SEND_RATE;
+    data->input_delay    = DEFAULT_INPUT_DELAY;
+    data->export_name    = NULL;
+    opterr               = 0;
+    while((opt = p101_getopt(env, argc, argv, "hbdwugtRr:l:o:p:m:n:s:S:P:F:D:e:")) != -1)
     {
         switch(opt)
         {
@@ -226,6 +441,88 @@ static void parse_arguments(const struct p101_env *env, int argc, char *argv[],
                 *will = true;
                 break;
             }
+            case 'u':
+            {
+                data->backend = NET_BACKEND_URING;
+                break;
+            }
+            case 'g':
+            {
+                data->graphical = true;
+                break;
+            }
+            case 't':
+            {
+                data->threaded = true;
+                break;
+            }
+            case 'm':
+            {
+                // A later option would reset err, so a bad value is reported here rather than after the loop
+                data->peer_rate = convert_rate(optarg, err);
+                if(*err != ERR_NONE)
+                {
+                    usage(argv[0], EXIT_FAILURE, "-m needs a rate from 1 to 65535.");
+                }
+                break;
+            }
+            case 'n':
+            {
+                data->send_rate = convert_rate(optarg, err);
+                if(*err != ERR_NONE)
+                {
+                    usage(argv[0], EXIT_FAILURE, "-n needs a rate from 1 to 65535.");
+                }
+                break;
+            }
+            case 's':
+            {
+                data->spectate_group = optarg;
+                break;
+            }
+            case 'S':
+            {
+                data->spectate_port = convert_port(optarg, err);
+                if(*err != ERR_NONE)
+                {
+                    usage(argv[0], EXIT_FAILURE, "-S needs a port number.");
+                }
+                break;
+            }
+            case 'P':
+            {
+                data->metrics_port = convert_port(optarg, err);
+                if(*err != ERR_NONE)
+                {
+                    usage(argv[0], EXIT_FAILURE, "-P needs a port number.");
+                }
+                break;
+            }
+            case 'F':
+            {
+                data->metrics_path = optarg;
+                break;
+            }
+            case 'R':
+            {
+                data->rollback_mode = true;
+                break;
+            }
+            case 'D':
+            {
+                data->input_delay = convert_delay(optarg, err);
+                if(*err != ERR_NONE)
+                {
+                    usage(argv[0], EXIT_FAILURE, "-D needs 0 to 8 frames of delay.");
+                }
+                delay_given = true;
+                break;
+            }
+            case 'e':
+            {
+                data->export_name = optarg;
+                break;
+            }
             case 'h':
             {
                 usage(argv[0], EXIT_SUCCESS, NULL);
@@ -255,6 +552,21 @@ static void parse_arguments(const struct p101_env *env, int argc, char *argv[],
         usage(argv[0], EXIT_FAILURE, "SRC and Destination IPs and ports are required.");
     }
 
+    if((data->spectate_group == NULL) != (data->spectate_port == 0))
+    {
+        usage(argv[0], EXIT_FAILURE, "A spectator group needs both -s and -S.");
+    }
+
+    if(data->threaded && data->graphical)
+    {
+        usage(argv[0], EXIT_FAILURE, "-t draws in the terminal and cannot be combined with -g.");
+    }
+
+    if(!data->rollback_mode && delay_given)
+    {
+        usage(argv[0], EXIT_FAILURE, "Input delay only applies in rollback mode (-R).");
+    }
+
     if(optind < argc)
     {
         usage(argv[0], EXIT_FAILURE, "Too many arguments.");
@@ -269,12 +581,24 @@ _Noreturn static void usage(const char *program_name, int exit_code, const char
         fprintf(stderr, "%s\n", message);
     }
 
-    fprintf(stderr, "Usage: %s -l <local ip addr> -r <remote ip addr> -p <local port> -o <remote port>[-h] [-b] [-d] [-w]\n", program_name);
+    fprintf(stderr, "Usage: %s -l <local ip addr> -r <remote ip addr> -p <local port> -o <remote port>[-h] [-b] [-d] [-w] [-u] [-g] [-t] [-m <datagrams per second>] [-n <updates per second>] [-s <multicast group> -S <port>] [-P <port>] [-F <file>] [-R [-D <frames>]] [-e <name>]\n", program_name);
     fputs("Options:\n", stderr);
     fputs("  -h   Display this help message\n", stderr);
     fputs("  -b   Display 'bad' transitions\n", stderr);
     fputs("  -w   Display 'will' transitions 'd'\n", stderr);
     fputs("  -d   Display 'did' transitions\n", stderr);
+    fputs("  -u   Use io_uring for the network if available\n", stderr);
+    fputs("  -g   Draw the board in an SDL window (SDL_VIDEODRIVER=dummy runs it headless)\n", stderr);
+    fputs("  -t   Run network I/O, input and drawing on their own threads\n", stderr);
+    fputs("  -m   Most datagrams per second accepted from the peer (default 200)\n", stderr);
+    fputs("  -n   Most move updates per second sent to the peer; faster moves are combined (default 30)\n", stderr);
+    fputs("  -s   Multicast group to publish the board to for spectators\n", stderr);
+    fputs("  -S   Port of the spectator group\n", stderr);
+    fputs("  -P   Serve Prometheus metrics on 127.0.0.1:<port>/metrics\n", stderr);
+    fputs("  -F   Rewrite <file> with Prometheus metrics every second\n", stderr);
+    fputs("  -R   Rollback mode: both sides run the same frames from each other's inputs (the peer needs -R too)\n", stderr);
+    fputs("  -D   Frames of input delay in rollback mode, 0 to 8 (default 2)\n", stderr);
+    fputs("  -e   Publish the board and counters to POSIX shared memory <name> for local tools (see state_watch)\n", stderr);
     exit(exit_code);
 }
 
@@ -317,6 +641,78 @@ done:
     return port;
 }
 
+// Converts a user-provided number into a non-zero rate limit
+uint32_t convert_rate(const char *str, int *err)
+{
+    uint32_t rate;
+    char    *endptr;
+    long     val;
+
+    *err  = ERR_NONE;
+    rate  = 0;
+    errno = 0;
+    val   = strtol(str, &endptr, 10);    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+
+    if(endptr == str)
+    {
+        *err = ERR_NO_DIGITS;
+        goto done;
+    }
+
+    if(val <= 0 || val > UINT16_MAX || errno != 0)
+    {
+        *err = ERR_OUT_OF_RANGE;
+        goto done;
+    }
+
+    if(*endptr != '\0')
+    {
+        *err = ERR_INVALID_CHARS;
+        goto done;
+    }
+
+    rate = (uint32_t)val;
+
+done:
+    return rate;
+}
+
+// Converts a user-provided number of frames of input delay, which may be zero
+uint32_t convert_delay(const char *str, int *err)
+{
+    uint32_t delay;
+    char    *endptr;
+    long     val;
+
+    *err  = ERR_NONE;
+    delay = 0;
+    errno = 0;
+    val   = strtol(str, &endptr, 10);    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+
+    if(endptr == str)
+    {
+        *err = ERR_NO_DIGITS;
+        goto done;
+    }
+
+    if(val < 0 || val > ROLLBACK_MAX_DELAY || errno != 0)
+    {
+        *err = ERR_OUT_OF_RANGE;
+        goto done;
+    }
+
+    if(*endptr != '\0')
+    {
+        *err = ERR_INVALID_CHARS;
+        goto done;
+    }
+
+    delay = (uint32_t)val;
+
+done:
+    return delay;
+}
+
 // Sets up a signal handler so the program can terminate gracefully
 static void setup_signal_handler(void)
 {
@@ -429,6 +825,8 @@ static p101_fsm_state_t setup(const struct p101_env *env, struct p101_error *err
     program_data *data    = ((program_data *)arg);
     int           check   = 0;
     data->direction       = 0;
+    data->net.backend     = NET_BACKEND_CLASSIC;
+    metrics_transition(data->fsm_metrics, SETUP - SETUP);
 
     // Initialize ncurses init screen and sets up screen
     initscr();
@@ -454,9 +852,22 @@ static p101_fsm_state_t setup(const struct p101_env *env, struct p101_error *err
     refresh();
     box(data->win, 0, 0);    // borders
 
+#if defined(__linux__) || (defined(__APPLE__) && defined(__MACH__))
+    if(data->graphical)
+    {
+        if(sdl_render_open(&data->sdl, "3980Game", cols, lines, TILE_PX, FRAMES_PER_SEC) != 0)
+        {
+            cleanup(data);
+            return ERROR;
+        }
+        sdl_render_border(&data->sdl);
+        pack_state(data, data->drawn);
+    }
+#endif
+
     // draw initial dots
-    mvwprintw(data->win, data->local_y, data->local_x, "*");
-    mvwprintw(data->win, data->remote_y, data->remote_x, "@");
+    draw_board(data);
+    box(data->win, 0, 0);    // borders
     wrefresh(data->win);
 
     check = socket_connect(data);
@@ -469,6 +880,87 @@ static p101_fsm_state_t setup(const struct p101_env *env, struct p101_error *err
 
     data->local_udp_socket = check;
 
+    // check still holds the socket, and setup_network_address only writes it on failure
+    check = 0;
+    setup_network_address(&data->remote_addr, &data->remote_addr_len, data->remote_ip, data->remote_port, &check);
+    if(check != 0)
+    {
+        cleanup(data);
+        return ERROR;
+    }
+
+    if(net_backend_open(&data->net, data->backend, data->local_udp_socket, &data->remote_addr, data->remote_addr_len) != data->backend)
+    {
+        printf("io_uring unavailable, falling back to select/sendto/recvfrom\n");
+    }
+    printf("Network backend: %s\n", net_backend_name(data->net.backend));
+
+    // Only the configured peer gets through, and only at a bounded rate
+    peer_filter_init(&data->filter, data->peer_rate, data->peer_rate / PEER_BURST_DIVISOR > MIN_PEER_BURST ? data->peer_rate / PEER_BURST_DIVISOR : MIN_PEER_BURST);
+    peer_filter_add(&data->filter, &data->remote_addr);
+
+    send_scheduler_init(&data->sched, data->send_rate);
+    sync_init(&data->sync);
+    if(data->rollback_mode)
+    {
+        // Both sides start from the same board and only ever exchange inputs, so there is nothing to join
+        memset(data->sim, ONE, sizeof(data->sim));
+        // Each side puts itself first, see step_players()
+        if(rollback_init(&data->rollback, data->sim, sizeof(data->sim), step_players, NULL, 0, data->input_delay) != 0)
+        {
+            cleanup(data);
+            return ERROR;
+        }
+        data->next_frame_us = monotonic_us();
+        data->idle_deadline = monotonic_ms() + (int64_t)TIMER_DELAY * MILLIS_PER_SEC;
+        printf("Rollback mode: %u frames of input delay\n", data->input_delay);
+    }
+    else
+    {
+        // Ask the peer for a snapshot in case it is already running
+        data->packet_len = sync_encode_join(data->packet, sizeof(data->packet));
+        send_udp_packet(data, data->packet, data->packet_len);
+        data->joining = true;
+    }
+
+    if(data->spectate_group != NULL)
+    {
+        struct sockaddr_storage group;
+        socklen_t               group_len;
+
+        setup_network_address(&group, &group_len, data->spectate_group, data->spectate_port, &check);
+        if(check != 0 || spectate_publisher_open(&data->spectate, &group, group_len, data->local_ip) != 0)
+        {
+            cleanup(data);
+            return ERROR;
+        }
+        printf("Publishing to spectators on %s port %d\n", data->spectate_group, data->spectate_port);
+        publish_spectators(data);
+    }
+
+    if(metrics_export_start(&data->metrics, data->metrics_port, data->metrics_path) != 0)
+    {
+        cleanup(data);
+        return ERROR;
+    }
+
+    if(data->export_name != NULL)
+    {
+        if(state_export_open(&data->shared_state, data->export_name) != 0)
+        {
+            cleanup(data);
+            return ERROR;
+        }
+        printf("Publishing state to shared memory %s\n", data->shared_state.name);
+    }
+
+    // From here on the FSM thread must not touch ncurses or the peer socket when threaded
+    if(data->threaded && pipeline_start(data) != 0)
+    {
+        cleanup(data);
+        return ERROR;
+    }
+
     return WAIT_FOR_INPUT;
 }
 
@@ -483,23 +975,51 @@ static p101_fsm_state_t wait_for_input(const struct p101_env *env, struct p101_e
     program_data *data;
 
     // Setup for monitoring input with timeout
-    fd_set             read_fds;
-    int                nfds = 0;
-    struct timeval     timeout;
-    int                retval;
-    struct sockaddr_in client_addr;
-    socklen_t          addr_len = sizeof(client_addr);
-    uint16_t           received_int;
+    int                     retval;
+    struct sockaddr_storage client_addr;
+    socklen_t               addr_len = sizeof(client_addr);
+    int64_t                 deadline;
+    int64_t                 remaining;
+    int                     timeout;
 
     P101_TRACE(env);
     data = ((program_data *)arg);
-    printf("waiting for input...\n");
+    metrics_transition(data->fsm_metrics, WAIT_FOR_INPUT - SETUP);
+    // Every state that changes the board or a counter comes back through here
+    export_state(data);
+    if(!data->rollback_mode)
+    {
+        printf("waiting for input...\n");
+    }
+
+    // Rollback mode comes back here every frame, so its timer move keeps its own deadline
+    deadline = data->rollback_mode ? data->idle_deadline : monotonic_ms() + (int64_t)TIMER_DELAY * MILLIS_PER_SEC;
+    if(data->rollback_mode && monotonic_ms() < data->invalid_until_ms)
+    {
+        data->invalid_move = true;
+    }
 
-    // Handles Invalid Moves
+    if(data->threaded)
+    {
+        render_frame frame;
+
+        frame.local_x      = data->local_x;
+        frame.local_y      = data->local_y;
+        frame.remote_x     = data->remote_x;
+        frame.remote_y     = data->remote_y;
+        frame.invalid_move = data->invalid_move;
+        data->invalid_move = false;
+        if(spsc_push(&data->pipeline.render, &frame))
+        {
+            spsc_doorbell_ring(&data->pipeline.render_bell);
+        }
+        return wait_threaded(data, deadline);
+    }
+
+    // Handles Invalid Moves. The message is on stdscr, under the board window, so both get refreshed.
     if(data->invalid_move)
     {
         mvprintw(LINES + 1, 0, "INVALID MOVE                              ");    // the line needs to be this long to clear the other text
-        wrefresh(data->win);
         data->invalid_move = false;
     }
     else
@@ -507,39 +1027,76 @@ static p101_fsm_state_t wait_for_input(const struct p101_env *env, struct p101_e
         mvprintw(LINES + 1, 0, " ");
         mvprintw(LINES + 1, 0, "Hit arrow keys or your controller to move.");
         box(data->win, ZERO, ZERO);    // borders
-        wrefresh(data->win);
     }
+    wnoutrefresh(stdscr);
+    wnoutrefresh(data->win);
+    doupdate();
 
-    // timeout
-    memset(&read_fds, 0, sizeof(read_fds));
-
-    FD_SET(STDIN_FILENO, &read_fds);
-    FD_SET((long unsigned int)data->local_udp_socket, &read_fds);
-
-    timeout.tv_sec  = TIMER_DELAY;
-    timeout.tv_usec = 0;
-
-    nfds = (nfds > data->local_udp_socket ? nfds : data->local_udp_socket) + 1;
-
-    // Triggers timer move unless something is pressed
-    retval = select(nfds, &read_fds, NULL, NULL, &timeout);
+    // Dropped datagrams come back here without redrawing, and without pushing the timer move back
+wait_again:
+#if defined(__linux__) || (defined(__APPLE__) && defined(__MACH__))
+    if(data->graphical)
+    {
+        // Presents at most FRAMES_PER_SEC frames, each copying only the tiles that changed
+        sdl_render_frame(&data->sdl);
+        if(data->sdl.quit)
+        {
+            cleanup(data);
+            exit_flag = SIGINT;
+            return P101_FSM_EXIT;
+        }
+        if(data->sdl.key != 0)
+        {
+            data->direction = data->sdl.key == SDLK_UP ? UP : data->sdl.key == SDLK_DOWN ? DOWN : data->sdl.key == SDLK_LEFT ? LEFT : RIGHT;
+            data->sdl.key   = 0;
+            return PROCESS_KEYBOARD_INPUT;
+        }
+    }
+#endif
+    // A board that has not moved for a while still goes out to spectators as a keyframe
+    spectate_tick(&data->spectate, monotonic_ms());
+    flush_moves(data);
+    if(data->rollback_mode && monotonic_us() >= data->next_frame_us)
+    {
+        return ADVANCE_FRAME;
+    }
+    remaining = deadline - monotonic_ms();
+    timeout   = spectate_timeout(&data->spectate, monotonic_ms(), remaining > 0 ? (int)remaining : 0);
+    timeout   = send_scheduler_timeout(&data->sched, monotonic_us(), timeout);
+    timeout   = frame_timeout(data, timeout);
+#if defined(__linux__) || (defined(__APPLE__) && defined(__MACH__))
+    if(data->graphical)
+    {
+        // Wake for the next frame and for window events as well as for the timer
+        timeout = sdl_render_timeout(&data->sdl, timeout);
+    }
+#endif
+    // Triggers timer move unless something is pressed; with io_uring this also submits any queued sends
+    retval = net_backend_wait(&data->net, STDIN_FILENO, timeout);
 
     if(retval == -1)
     {
-        perror("select");
+        metrics_count(data->fsm_metrics, METRIC_SOCKET_ERRORS);
+        perror("net_backend_wait");
         cleanup(data);
-        printf("exiting due to select...\n");
+        printf("exiting due to wait...\n");
         return ERROR;
     }
 
     if(retval == 0)
     {
+        if(monotonic_ms() < deadline)
+        {
+            // Woke up for a frame, a spectator keyframe, a held-back move or a rollback tick, not for the timer
+            goto wait_again;
+        }
         // Timeout occurred, trigger timer-based move
         printf("moving with timer\n");
+        data->noticed_us = monotonic_us();
         return PROCESS_TIMER_MOVE;
     }
 
-    if(FD_ISSET(STDIN_FILENO, &read_fds))
+    if(retval & NET_READY_EXTRA)
     {
         // Input detected, handle keyboard input
         char    buffer[LINES];
@@ -561,50 +1118,32 @@ static p101_fsm_state_t wait_for_input(const struct p101_env *env, struct p101_e
             return P101_FSM_EXIT;
         }
 
-        // A == up -> 1
-        if(buffer[2] == 'A')
-        {
-            data->direction = UP;
-        }
-        // B == down -> 3
-        else if(buffer[2] == 'B')
-        {
-            data->direction = DOWN;
-        }
-        // C == right -> 2
-        else if(buffer[2] == 'C')
-        {
-            data->direction = RIGHT;
-        }
-        // D == left -> 4
-        else if(buffer[2] == 'D')
-        {
-            data->direction = LEFT;
-        }
-
-        else
-        {
-            data->direction = NONE;
-        }
+        data->direction  = key_direction(buffer, bytes_read);
+        data->noticed_us = monotonic_us();
         return PROCESS_KEYBOARD_INPUT;
     }
 
-    if(FD_ISSET((long unsigned int)data->local_udp_socket, &read_fds))
+    if(retval & NET_READY_PACKET)
     {
         ssize_t bytes_received;
         // UDP packet received
-        bytes_received = recvfrom(data->local_udp_socket, &received_int, sizeof(received_int), 0, (struct sockaddr *)&client_addr, &addr_len);
+        bytes_received = net_backend_recv(&data->net, data->packet, sizeof(data->packet), &client_addr, &addr_len);
         if(bytes_received < 0)
         {
+            metrics_count(data->fsm_metrics, METRIC_SOCKET_ERRORS);
             perror("recvfrom");
             cleanup(data);
             printf("exiting due to recvfrom...\n");
             return ERROR;
         }
+        metrics_count(data->fsm_metrics, METRIC_PACKETS_RECEIVED);
+        data->noticed_us = monotonic_us();
 
-        // Update program data with received integer
-        data->received_value = ntohs(received_int);    // Convert from network byte order
-        return MOVE_REMOTE;
+        if(!accept_packet(data, data->packet, &client_addr, (size_t)bytes_received))
+        {
+            goto wait_again;
+        }
+        return route_packet(data, (size_t)bytes_received);
     }
 
     return WAIT_FOR_INPUT;
@@ -621,13 +1160,26 @@ static p101_fsm_state_t process_keyboard_input(const struct p101_env *env, struc
     int           valid_direction;
     program_data *data = ((program_data *)arg);
     P101_TRACE(env);
-    box(data->win, ZERO, ZERO);    // borders
-    wrefresh(data->win);
+    metrics_transition(data->fsm_metrics, PROCESS_KEYBOARD_INPUT - SETUP);
+    if(!data->threaded)
+    {
+        box(data->win, ZERO, ZERO);    // borders
+        wrefresh(data->win);
+    }
     // gets input from the keyboard into the program data somehow
 
+    if(data->rollback_mode)
+    {
+        queue_input(data);
+        return WAIT_FOR_INPUT;
+    }
     valid_direction = process_direction(data);
     if(valid_direction == -1)
     {
+        if(data->invalid_move)
+        {
+            metrics_count(data->fsm_metrics, METRIC_INVALID_MOVES);
+        }
         return WAIT_FOR_INPUT;
     }
     return MOVE_LOCAL;
@@ -716,16 +1268,30 @@ static p101_fsm_state_t process_timer_move(const struct p101_env *env, struct p1
     program_data *data = ((program_data *)arg);
     int           valid_direction;
     P101_TRACE(env);
-    box(data->win, ZERO, ZERO);
-    wrefresh(data->win);
+    metrics_transition(data->fsm_metrics, PROCESS_TIMER_MOVE - SETUP);
+    metrics_count(data->fsm_metrics, METRIC_TIMER_MOVES);
+    if(!data->threaded)
+    {
+        box(data->win, ZERO, ZERO);
+        wrefresh(data->win);
+    }
 
     // Generate random direction: 0 = LEFT, 1 = RIGHT, 2 = UP, 3 = DOWN
     direction       = arc4random_uniform(4);
     data->direction = (int)direction + 1;
-    // Adjust position based on direction
-    valid_direction = process_direction(data);
+    if(data->rollback_mode)
+    {
+        queue_input(data);
+        return WAIT_FOR_INPUT;
+    }
+    // Adjust position based on direction
+    valid_direction = process_direction(data);
     if(valid_direction == -1)
     {
+        if(data->invalid_move)
+        {
+            metrics_count(data->fsm_metrics, METRIC_INVALID_MOVES);
+        }
         return WAIT_FOR_INPUT;
     }
     // Trigger MOVE_LOCAL for valid moves
@@ -743,10 +1309,17 @@ static p101_fsm_state_t move_local(const struct p101_env *env, struct p101_error
     program_data *data;
     P101_TRACE(env);
     data = ((program_data *)arg);
-    wclear(data->win);
-    mvwprintw(data->win, data->local_y, data->local_x, "*");
-    mvwprintw(data->win, data->remote_y, data->remote_x, "@");
-    send_udp_packet(data->remote_ip, data->remote_port, data->send_value);
+    metrics_transition(data->fsm_metrics, MOVE_LOCAL - SETUP);
+    draw_board(data);
+    publish_spectators(data);
+
+    // Goes out now if the line has been quiet, otherwise with the next send tick
+    if(data->sched.pending)
+    {
+        metrics_count(data->fsm_metrics, METRIC_MOVES_COALESCED);
+    }
+    send_scheduler_queue(&data->sched, data->noticed_us);
+    flush_moves(data);
     return WAIT_FOR_INPUT;
 }
 
@@ -760,7 +1333,7 @@ static p101_fsm_state_t move_remote(const struct p101_env *env, struct p101_erro
 {
     program_data *data = ((program_data *)arg);
     P101_TRACE(env);
-    wclear(data->win);
+    metrics_transition(data->fsm_metrics, MOVE_REMOTE - SETUP);
 
     switch(data->received_value)
     {
@@ -793,11 +1366,148 @@ static p101_fsm_state_t move_remote(const struct p101_env *env, struct p101_erro
             }
             break;
         default:
-            printf("unknown keyboard input\n");
-            sleep(2);
+            // accept_packet() already rejects anything else
+            break;
     }
-    mvwprintw(data->win, data->remote_y, data->remote_x, "@");
-    mvwprintw(data->win, data->local_y, data->local_x, "*");
+    draw_board(data);
+    publish_spectators(data);
+    metrics_observe_us(data->fsm_metrics, METRIC_PACKET_LATENCY, monotonic_us() - data->noticed_us);
+    return WAIT_FOR_INPUT;
+}
+
+#pragma GCC diagnostic pop
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+
+// Handles join requests, snapshots, deltas and acks from the peer
+static p101_fsm_state_t apply_sync(const struct p101_env *env, struct p101_error *err, void *arg)
+{
+    program_data *data = ((program_data *)arg);
+    sync_message  msg;
+    uint8_t       state[SYNC_STATE_MAX];
+    size_t        state_len;
+    P101_TRACE(env);
+    metrics_transition(data->fsm_metrics, APPLY_SYNC - SETUP);
+
+    switch(sync_decode(&data->sync, data->packet, data->packet_len, &msg))
+    {
+        case SYNC_MSG_JOIN:
+            // The peer just started or reconnected, so bring it up to date in one datagram. It has
+            // nothing of ours to hand back any more.
+            data->joining    = false;
+            state_len        = pack_state(data, state);
+            data->packet_len = sync_encode_snapshot(&data->sync, state, state_len, data->packet, sizeof(data->packet));
+            note_sent(data);
+            send_udp_packet(data, data->packet, data->packet_len);
+            return WAIT_FOR_INPUT;
+        case SYNC_MSG_SNAPSHOT:
+            // The peer's view of us is only trusted in the answer to our join, which lets a restarted player
+            // resume. Other snapshots are the peer falling back for want of a baseline; our own moves may
+            // still be in flight, so those only move the peer, as a delta does.
+            if(!on_board(msg.state[0], msg.state[1]) || (data->joining && !on_board(msg.state[2], msg.state[3])))
+            {
+                return WAIT_FOR_INPUT;
+            }
+            if(data->joining)
+            {
+                data->local_x = msg.state[2];
+                data->local_y = msg.state[3];
+                data->joining = false;
+            }
+            data->remote_x = msg.state[0];
+            data->remote_y = msg.state[1];
+            break;
+        case SYNC_MSG_DELTA:
+            if(!on_board(msg.state[0], msg.state[1]))
+            {
+                return WAIT_FOR_INPUT;
+            }
+            data->remote_x = msg.state[0];
+            data->remote_y = msg.state[1];
+            break;
+        case SYNC_MISSING_BASELINE:
+            // A delta against a frame we never saw: ask for a fresh snapshot
+            data->packet_len = sync_encode_join(data->packet, sizeof(data->packet));
+            send_udp_packet(data, data->packet, data->packet_len);
+            return WAIT_FOR_INPUT;
+        case SYNC_MSG_ACK:
+            // Only the first ack of an update counts towards the round trip
+            if(data->sync.sent[msg.seq % SYNC_HISTORY].seq == msg.seq && data->sent_at_us[msg.seq % SYNC_HISTORY] != 0)
+            {
+                metrics_observe_us(data->fsm_metrics, METRIC_PEER_RTT, monotonic_us() - data->sent_at_us[msg.seq % SYNC_HISTORY]);
+                data->sent_at_us[msg.seq % SYNC_HISTORY] = 0;
+            }
+            return WAIT_FOR_INPUT;
+        default:
+            // Stale or malformed datagrams need no redraw
+            return WAIT_FOR_INPUT;
+    }
+
+    data->packet_len = sync_encode_ack(msg.seq, data->packet, sizeof(data->packet));
+    send_udp_packet(data, data->packet, data->packet_len);
+
+    draw_board(data);
+    publish_spectators(data);
+    metrics_observe_us(data->fsm_metrics, METRIC_PACKET_LATENCY, monotonic_us() - data->noticed_us);
+    return WAIT_FOR_INPUT;
+}
+
+#pragma GCC diagnostic pop
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+
+// Runs one rollback frame with the move queued since the last one, after re-running any frames a
+// late remote input proved wrong, then shows the result and sends our latest inputs to the peer
+static p101_fsm_state_t advance_frame(const struct p101_env *env, struct p101_error *err, void *arg)
+{
+    program_data *data = ((program_data *)arg);
+    uint8_t       board[BOARD_STATE];
+    int64_t       now = monotonic_us();
+    P101_TRACE(env);
+    metrics_transition(data->fsm_metrics, ADVANCE_FRAME - SETUP);
+
+    // A late wakeup runs one frame rather than a burst of them; the peers' frame sync absorbs the difference
+    data->next_frame_us += MICROS_PER_SEC / FRAMES_PER_SEC;
+    if(data->next_frame_us < now)
+    {
+        data->next_frame_us = now + MICROS_PER_SEC / FRAMES_PER_SEC;
+    }
+    if(rollback_advance(&data->rollback, data->pending_input))
+    {
+        data->pending_input = ROLLBACK_INPUT_NONE;
+    }
+
+    pack_state(data, board);
+    if(memcmp(board, data->sim, sizeof(board)) != 0)
+    {
+        data->local_x  = data->sim[0];
+        data->local_y  = data->sim[1];
+        data->remote_x = data->sim[2];
+        data->remote_y = data->sim[3];
+        draw_board(data);
+        publish_spectators(data);
+    }
+
+    data->packet_len = rollback_encode_inputs(&data->rollback, data->packet, sizeof(data->packet));
+    send_udp_packet(data, data->packet, data->packet_len);
+    return WAIT_FOR_INPUT;
+}
+
+#pragma GCC diagnostic pop
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+
+// Hands the peer's frame-tagged inputs to the rollback session; a wrong prediction is corrected on the next frame
+static p101_fsm_state_t apply_inputs(const struct p101_env *env, struct p101_error *err, void *arg)
+{
+    program_data *data = ((program_data *)arg);
+    P101_TRACE(env);
+    metrics_transition(data->fsm_metrics, APPLY_INPUTS - SETUP);
+
+    rollback_decode_inputs(&data->rollback, data->packet, data->packet_len);
     return WAIT_FOR_INPUT;
 }
 
@@ -809,7 +1519,9 @@ static p101_fsm_state_t move_remote(const struct p101_env *env, struct p101_erro
 // Handles errors by transitioning the program to an exit state
 static p101_fsm_state_t state_error(const struct p101_env *env, struct p101_error *err, void *arg)
 {
+    const program_data *data = ((program_data *)arg);
     P101_TRACE(env);
+    metrics_transition(data->fsm_metrics, ERROR - SETUP);
 
     return P101_FSM_EXIT;
 }
@@ -869,44 +1581,661 @@ int process_direction(program_data *data)
     return 0;
 }
 
-// Sends a UDP packet with the local player’s movement data to the remote system
-void send_udp_packet(const char *remote_ip, in_port_t remote_port, uint16_t send_value)
+// Sends a datagram to the remote system from the bound socket, so replies come back to our port.
+// With io_uring the send is only queued here and goes out with the next wait.
+static void send_udp_packet(program_data *data, const uint8_t *buf, size_t len)
 {
-    int                     sockfd;
-    struct sockaddr_storage dest_addr;
-    socklen_t               addr_len;
-    int                     ret_val = 0;
+    if(len == 0)
+    {
+        return;
+    }
+    if(data->threaded)
+    {
+        net_event event;
 
-    setup_network_address(&dest_addr, &addr_len, remote_ip, remote_port, &ret_val);
-    if(ret_val != 0)
+        // The network thread owns the socket; if it is this far behind, the datagram is dropped like any lost one
+        event.len = len;
+        memcpy(event.bytes, buf, len);
+        if(!spsc_push(&data->pipeline.outbound, &event))
+        {
+            data->pipeline.dropped_outbound++;
+            return;
+        }
+        spsc_doorbell_ring(&data->pipeline.net_bell);
+        return;
+    }
+    if(net_backend_send(&data->net, buf, len) < 0)
     {
-        perror("Setup network address failed");
+        metrics_count(data->fsm_metrics, METRIC_SOCKET_ERRORS);
+        perror("Sendto failed");
         exit_flag = SIGINT;
+        return;
     }
+    metrics_count(data->fsm_metrics, METRIC_PACKETS_SENT);
+}
 
-    // Create a UDP socket
-    sockfd = socket(dest_addr.ss_family, SOCK_DGRAM, 0);    // NOLINT(android-cloexec-socket)
-    if(sockfd < 0)
+// Drops datagrams from unknown senders, over the peer's rate, or of the wrong shape, before any decoding or drawing
+static bool accept_packet(program_data *data, const uint8_t *buf, const struct sockaddr_storage *from, size_t len)
+{
+    if(peer_filter_check(&data->filter, from) != PEER_ACCEPT)
     {
-        perror("Socket creation failed");
-        exit_flag = SIGINT;
+        return false;
     }
-    else
+    if(data->rollback_mode)
     {
-        // Send the integer
-        if(sendto(sockfd, &send_value, sizeof(send_value), 0, (struct sockaddr *)&dest_addr, addr_len) < 0)
+        // Positions only ever come from running the frames, so sync messages have nothing to say
+        if(rollback_plausible(buf, len))
         {
-            perror("Sendto failed");
-            exit_flag = SIGINT;
+            return true;
+        }
+    }
+    else if(len == sizeof(uint16_t))
+    {
+        uint16_t value;
+
+        memcpy(&value, buf, sizeof(value));
+        value = ntohs(value);
+        if(value >= UP && value <= LEFT)
+        {
+            return true;
+        }
+    }
+    else if(sync_plausible(buf, len))
+    {
+        return true;
+    }
+    peer_filter_count_malformed(&data->filter);
+    return false;
+}
+
+static int64_t monotonic_ms(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * MILLIS_PER_SEC + now.tv_nsec / NANOS_PER_MILLI;
+}
+
+static int64_t monotonic_us(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * MICROS_PER_SEC + now.tv_nsec / NANOS_PER_MICRO;
+}
+
+// Sends our position once a local move is waiting and the send rate allows it. Moves made since the
+// last send are all in the position, so the peer gets their net displacement in one datagram.
+static void flush_moves(program_data *data)
+{
+    uint8_t state[SYNC_STATE_MAX];
+    size_t  state_len;
+    int64_t now = monotonic_us();
+
+    if(!send_scheduler_due(&data->sched, now))
+    {
+        return;
+    }
+    // Delta against whatever the peer last acknowledged, or a full snapshot if it has acknowledged nothing
+    state_len        = pack_state(data, state);
+    data->packet_len = sync_encode_update(&data->sync, state, state_len, data->packet, sizeof(data->packet));
+    note_sent(data);
+    send_udp_packet(data, data->packet, data->packet_len);
+    send_scheduler_sent(&data->sched, now);
+    metrics_observe_us(data->fsm_metrics, METRIC_MOVE_LATENCY, now - data->sched.pending_since_us);
+}
+
+// Remembers when the snapshot or delta just encoded went out, for the round trip once the peer acks it
+static void note_sent(program_data *data)
+{
+    if(data->packet_len > 0)
+    {
+        data->sent_at_us[(uint16_t)(data->sync.next_seq - 1) % SYNC_HISTORY] = monotonic_us();
+    }
+}
+
+// The cells process_direction() lets a player reach; anything else came from a buggy or spoofed peer
+static bool on_board(int x, int y)
+{
+    return x >= 1 && x <= COLS - 2 && y >= 1 && y <= LINES - 2;
+}
+
+// Serialises the board from our point of view: our position, then where we last saw the peer
+static size_t pack_state(const program_data *data, uint8_t *state)
+{
+    state[0] = (uint8_t)data->local_x;
+    state[1] = (uint8_t)data->local_y;
+    state[2] = (uint8_t)data->remote_x;
+    state[3] = (uint8_t)data->remote_y;
+    return 4;
+}
+
+// Draws both players, in the terminal or, with -g, as tiles in the SDL window where only
+// the four tiles they leave and enter are marked for redrawing
+static void draw_board(program_data *data)
+{
+#if defined(__linux__) || (defined(__APPLE__) && defined(__MACH__))
+    if(data->graphical)
+    {
+        uint8_t state[SYNC_STATE_MAX];
+
+        pack_state(data, state);
+        sdl_render_set(&data->sdl, data->drawn[0], data->drawn[1], TILE_EMPTY);
+        sdl_render_set(&data->sdl, data->drawn[2], data->drawn[3], TILE_EMPTY);
+        sdl_render_set(&data->sdl, state[2], state[3], TILE_REMOTE);
+        sdl_render_set(&data->sdl, state[0], state[1], TILE_LOCAL);
+        memcpy(data->drawn, state, sizeof(data->drawn));
+        return;
+    }
+#endif
+    if(data->threaded && data->pipeline.threads > 0)
+    {
+        // The render thread draws from the frame wait_for_input() hands it
+        return;
+    }
+    wclear(data->win);
+    mvwprintw(data->win, data->remote_y, data->remote_x, "@");
+    mvwprintw(data->win, data->local_y, data->local_x, "*");
+}
+
+// Sends the board to the spectator group, if there is one
+static void publish_spectators(program_data *data)
+{
+    uint8_t state[SYNC_STATE_MAX];
+    size_t  state_len;
+
+    state_len = pack_state(data, state);
+    spectate_publish(&data->spectate, state, state_len, monotonic_ms());
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+
+// Fails to compile if COLS or LINES ever stop being constants, which would let peers disagree on the board
+_Static_assert(COLS - 2 <= UINT8_MAX && LINES - 2 <= UINT8_MAX, "the rollback board must be a fixed size that fits in a byte");
+
+// One rollback frame: each player moves one cell for its input, with the same bounds process_direction() enforces.
+// Players never affect each other, so each side can list itself first, as pack_state() does, and both still
+// agree on every frame. Besides its arguments it reads only COLS and LINES, which in this file are the fixed
+// board size rather than ncurses' terminal size, so a re-run frame always ends the same way on both peers.
+static void step_players(void *ctx, uint8_t *sim, const uint8_t *inputs)
+{
+    for(int player = 0; player < ROLLBACK_PLAYERS; player++)
+    {
+        uint8_t *x = &sim[player * 2];
+        uint8_t *y = &sim[(player * 2) + 1];
+
+        switch(inputs[player])
+        {
+            case LEFT:
+                *x = *x > 1 ? (uint8_t)(*x - 1) : *x;
+                break;
+            case RIGHT:
+                *x = *x < COLS - 2 ? (uint8_t)(*x + 1) : *x;
+                break;
+            case UP:
+                *y = *y > 1 ? (uint8_t)(*y - 1) : *y;
+                break;
+            case DOWN:
+                *y = *y < LINES - 2 ? (uint8_t)(*y + 1) : *y;
+                break;
+            default:
+                // No input, or one from a newer peer that this build does not know
+                break;
+        }
+    }
+}
+
+#pragma GCC diagnostic pop
+
+// Holds a key press or timer move for the next rollback frame. A move off the board is flagged
+// here, against the board as we currently predict it, rather than silently doing nothing.
+static void queue_input(program_data *data)
+{
+    uint8_t trial[BOARD_STATE];
+    uint8_t inputs[ROLLBACK_PLAYERS] = {ROLLBACK_INPUT_NONE, ROLLBACK_INPUT_NONE};
+
+    if(data->direction < UP || data->direction > LEFT)
+    {
+        return;
+    }
+    data->idle_deadline = monotonic_ms() + (int64_t)TIMER_DELAY * MILLIS_PER_SEC;
+    memcpy(trial, data->sim, sizeof(trial));
+    inputs[0] = (uint8_t)data->direction;
+    step_players(NULL, trial, inputs);
+    if(memcmp(trial, data->sim, sizeof(trial)) == 0)
+    {
+        data->invalid_move     = true;
+        data->invalid_until_ms = monotonic_ms() + INVALID_MOVE_MS;
+        metrics_count(data->fsm_metrics, METRIC_INVALID_MOVES);
+        return;
+    }
+    data->pending_input = (uint8_t)data->direction;
+}
+
+// Shortens a wait so the next rollback frame runs on time
+static int frame_timeout(const program_data *data, int timeout_ms)
+{
+    int64_t wait_us;
+    int64_t wait_ms;
+
+    if(!data->rollback_mode)
+    {
+        return timeout_ms;
+    }
+    wait_us = data->next_frame_us - monotonic_us();
+    wait_ms = wait_us > 0 ? (wait_us + MICROS_PER_MILLI - 1) / MICROS_PER_MILLI : 0;
+    return timeout_ms < 0 || wait_ms < timeout_ms ? (int)wait_ms : timeout_ms;
+}
+
+// Mirrors the board and counters into the shared-memory segment, if there is one. Only this thread
+// writes it, and a publish is a few stores with no system call, so tools can poll it freely.
+static void export_state(program_data *data)
+{
+    int64_t fields[STATE_FIELDS];
+
+    if(data->shared_state.page == NULL)
+    {
+        return;
+    }
+    fields[STATE_FIELD_LOCAL_X]          = data->local_x;
+    fields[STATE_FIELD_LOCAL_Y]          = data->local_y;
+    fields[STATE_FIELD_REMOTE_X]         = data->remote_x;
+    fields[STATE_FIELD_REMOTE_Y]         = data->remote_y;
+    fields[STATE_FIELD_UPDATED_US]       = 0;
+    fields[STATE_FIELD_PACKETS_SENT]     = (int64_t)metrics_total(&data->metrics, METRIC_PACKETS_SENT);
+    fields[STATE_FIELD_PACKETS_RECEIVED] = (int64_t)metrics_total(&data->metrics, METRIC_PACKETS_RECEIVED);
+    fields[STATE_FIELD_INVALID_MOVES]    = (int64_t)metrics_total(&data->metrics, METRIC_INVALID_MOVES);
+    fields[STATE_FIELD_TIMER_MOVES]      = (int64_t)metrics_total(&data->metrics, METRIC_TIMER_MOVES);
+    fields[STATE_FIELD_MOVES_SENT]       = (int64_t)data->sched.sent;
+    fields[STATE_FIELD_MOVES_COALESCED]  = (int64_t)data->sched.coalesced;
+    fields[STATE_FIELD_ROLLBACK_FRAME]   = data->rollback.frame;
+    fields[STATE_FIELD_ROLLBACKS]        = (int64_t)data->rollback.rollbacks;
+    state_export_publish(&data->shared_state, fields, monotonic_us());
+}
+
+// Arrow keys arrive as ESC [ A..D
+static int key_direction(const char *buffer, ssize_t len)
+{
+    if(len < 3)
+    {
+        return NONE;
+    }
+    // A == up -> 1
+    if(buffer[2] == 'A')
+    {
+        return UP;
+    }
+    // B == down -> 3
+    if(buffer[2] == 'B')
+    {
+        return DOWN;
+    }
+    // C == right -> 2
+    if(buffer[2] == 'C')
+    {
+        return RIGHT;
+    }
+    // D == left -> 4
+    if(buffer[2] == 'D')
+    {
+        return LEFT;
+    }
+    return NONE;
+}
+
+// Picks the state for an accepted datagram already copied into data->packet
+static p101_fsm_state_t route_packet(program_data *data, size_t len)
+{
+    // A bare uint16_t is a direction from a peer that predates snapshots
+    if(len == sizeof(uint16_t))
+    {
+        uint16_t received_int;
+
+        memcpy(&received_int, data->packet, sizeof(received_int));
+        data->received_value = ntohs(received_int);    // Convert from network byte order
+        return MOVE_REMOTE;
+    }
+
+    data->packet_len = len;
+    return data->rollback_mode ? APPLY_INPUTS : APPLY_SYNC;
+}
+
+// wait_for_input() for -t: takes key presses and datagrams from the other threads' rings,
+// sleeping on the doorbell until one arrives or the timer move is due
+static p101_fsm_state_t wait_threaded(program_data *data, int64_t deadline)
+{
+    thread_pipeline *stages  = &data->pipeline;
+    spsc_ring *const rings[] = {&stages->input, &stages->inbound};
+
+    for(;;)
+    {
+        input_record input;
+        net_event    event;
+        int64_t      remaining;
+        int          timeout;
+
+        if(spsc_pop(&stages->input, &input))
+        {
+            if(input.kind == INPUT_QUIT)
+            {
+                printf("Ctrl+C detected, exiting gracefully.\n");
+                cleanup(data);
+                exit_flag = SIGINT;
+                return P101_FSM_EXIT;
+            }
+            data->direction  = input.direction;
+            data->noticed_us = input.noticed_us;
+            return PROCESS_KEYBOARD_INPUT;
         }
-        // Close the socket
-        close(sockfd);
+
+        if(spsc_pop(&stages->inbound, &event))
+        {
+            if(event.len == 0)
+            {
+                cleanup(data);
+                printf("exiting due to the network thread...\n");
+                return ERROR;
+            }
+            memcpy(data->packet, event.bytes, event.len);
+            data->noticed_us = event.received_us;
+            return route_packet(data, event.len);
+        }
+
+        spectate_tick(&data->spectate, monotonic_ms());
+        flush_moves(data);
+        if(data->rollback_mode && monotonic_us() >= data->next_frame_us)
+        {
+            return ADVANCE_FRAME;
+        }
+        remaining = deadline - monotonic_ms();
+        if(remaining <= 0)
+        {
+            printf("moving with timer\n");
+            data->noticed_us = monotonic_us();
+            return PROCESS_TIMER_MOVE;
+        }
+        timeout = spectate_timeout(&data->spectate, monotonic_ms(), (int)remaining);
+        timeout = send_scheduler_timeout(&data->sched, monotonic_us(), timeout);
+        timeout = frame_timeout(data, timeout);
+        if(spsc_doorbell_wait(&stages->sim_bell, rings, 2, timeout) < 0 && errno != EINTR)
+        {
+            perror("poll");
+            cleanup(data);
+            return ERROR;
+        }
+    }
+}
+
+// Creates the rings and starts the network, input and render threads
+static int pipeline_start(program_data *data)
+{
+    thread_pipeline *stages = &data->pipeline;
+
+    memset(stages, 0, sizeof(*stages));
+    stages->sim_bell.fds[0]    = -1;
+    stages->net_bell.fds[0]    = -1;
+    stages->input_bell.fds[0]  = -1;
+    stages->render_bell.fds[0] = -1;
+    atomic_init(&stages->stop, false);
+    stages->ready   = true;
+    stages->metrics = metrics_register(&data->metrics);
+
+    if(spsc_init(&stages->input, sizeof(input_record), INPUT_RING) != 0 || spsc_init(&stages->inbound, sizeof(net_event), NET_RING) != 0 ||
+       spsc_init(&stages->outbound, sizeof(net_event), NET_RING) != 0 || spsc_init(&stages->render, sizeof(render_frame), RENDER_RING) != 0 ||
+       spsc_doorbell_init(&stages->sim_bell) != 0 || spsc_doorbell_init(&stages->net_bell) != 0 || spsc_doorbell_init(&stages->input_bell) != 0 ||
+       spsc_doorbell_init(&stages->render_bell) != 0)
+    {
+        pipeline_stop(data);
+        return -1;
+    }
+
+    // Records already queued by setup(), such as the join, go out as soon as the network thread starts
+    if(pthread_create(&stages->net_thread, NULL, net_thread, data) != 0)
+    {
+        perror("pthread_create");
+        pipeline_stop(data);
+        return -1;
+    }
+    stages->threads++;
+    if(pthread_create(&stages->input_thread, NULL, input_thread, data) != 0)
+    {
+        perror("pthread_create");
+        pipeline_stop(data);
+        return -1;
+    }
+    stages->threads++;
+    if(pthread_create(&stages->render_thread, NULL, render_thread, data) != 0)
+    {
+        perror("pthread_create");
+        pipeline_stop(data);
+        return -1;
+    }
+    stages->threads++;
+    return 0;
+}
+
+// Stops and joins whichever threads were started, then frees the rings; safe to call more than once
+static void pipeline_stop(program_data *data)
+{
+    thread_pipeline *stages = &data->pipeline;
+
+    if(!stages->ready)
+    {
+        return;
+    }
+    atomic_store(&stages->stop, true);
+    spsc_doorbell_wake(&stages->net_bell);
+    spsc_doorbell_wake(&stages->input_bell);
+    spsc_doorbell_wake(&stages->render_bell);
+    if(stages->threads > 0)
+    {
+        pthread_join(stages->net_thread, NULL);
+    }
+    if(stages->threads > 1)
+    {
+        pthread_join(stages->input_thread, NULL);
+    }
+    if(stages->threads > 2)
+    {
+        pthread_join(stages->render_thread, NULL);
+    }
+    stages->threads = 0;
+
+    spsc_destroy(&stages->input);
+    spsc_destroy(&stages->inbound);
+    spsc_destroy(&stages->outbound);
+    spsc_destroy(&stages->render);
+    spsc_doorbell_destroy(&stages->sim_bell);
+    spsc_doorbell_destroy(&stages->net_bell);
+    spsc_doorbell_destroy(&stages->input_bell);
+    spsc_doorbell_destroy(&stages->render_bell);
+    stages->ready = false;
+}
+
+// Owns the peer socket: sends whatever the simulation queued, and filters and forwards whatever arrives
+static void *net_thread(void *arg)
+{
+    program_data    *data   = (program_data *)arg;
+    thread_pipeline *stages = &data->pipeline;
+
+    while(!atomic_load(&stages->stop))
+    {
+        net_event event;
+        socklen_t from_len = sizeof(event.from);
+        ssize_t   bytes;
+        int       ready;
+
+        while(spsc_pop(&stages->outbound, &event))
+        {
+            if(net_backend_send(&data->net, event.bytes, event.len) < 0)
+            {
+                metrics_count(stages->metrics, METRIC_SOCKET_ERRORS);
+                perror("Sendto failed");
+                continue;
+            }
+            metrics_count(stages->metrics, METRIC_PACKETS_SENT);
+        }
+
+        // With io_uring the wait also submits the sends queued above
+        spsc_doorbell_arm(&stages->net_bell);
+        ready = spsc_empty(&stages->outbound) ? net_backend_wait(&data->net, stages->net_bell.fds[0], NET_THREAD_IDLE_MS) : NET_READY_EXTRA;
+        spsc_doorbell_disarm(&stages->net_bell);
+        if(ready < 0)
+        {
+            metrics_count(stages->metrics, METRIC_SOCKET_ERRORS);
+            perror("net_backend_wait");
+            break;
+        }
+        if((ready & NET_READY_PACKET) == 0)
+        {
+            continue;
+        }
+
+        bytes = net_backend_recv(&data->net, event.bytes, sizeof(event.bytes), &event.from, &from_len);
+        if(bytes < 0)
+        {
+            metrics_count(stages->metrics, METRIC_SOCKET_ERRORS);
+            perror("recvfrom");
+            break;
+        }
+        metrics_count(stages->metrics, METRIC_PACKETS_RECEIVED);
+        if(!accept_packet(data, event.bytes, &event.from, (size_t)bytes))
+        {
+            continue;
+        }
+        event.len         = (size_t)bytes;
+        event.received_us = monotonic_us();
+        if(!spsc_push(&stages->inbound, &event))
+        {
+            stages->dropped_inbound++;
+            continue;
+        }
+        spsc_doorbell_ring(&stages->sim_bell);
+    }
+
+    if(!atomic_load(&stages->stop))
+    {
+        // Tell the simulation the network is gone
+        net_event failed;
+
+        failed.len = 0;
+        if(spsc_push(&stages->inbound, &failed))
+        {
+            spsc_doorbell_ring(&stages->sim_bell);
+        }
+    }
+    return NULL;
+}
+
+// Turns key presses into records for the simulation
+static void *input_thread(void *arg)
+{
+    program_data    *data   = (program_data *)arg;
+    thread_pipeline *stages = &data->pipeline;
+
+    while(!atomic_load(&stages->stop))
+    {
+        struct pollfd fds[2];
+        char          buffer[LINES];
+        ssize_t       bytes_read;
+        input_record  input;
+
+        fds[0].fd     = STDIN_FILENO;
+        fds[0].events = POLLIN;
+        fds[1].fd     = stages->input_bell.fds[0];
+        fds[1].events = POLLIN;
+        if(poll(fds, 2, -1) < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            perror("poll");
+            break;
+        }
+        if((fds[0].revents & POLLIN) == 0)
+        {
+            continue;
+        }
+
+        bytes_read = read(STDIN_FILENO, buffer, sizeof(buffer) - 1);
+        if(bytes_read <= 0 || buffer[0] == '\x03')
+        {
+            input.kind      = INPUT_QUIT;
+            input.direction = NONE;
+        }
+        else
+        {
+            input.kind      = INPUT_KEY;
+            input.direction = key_direction(buffer, bytes_read);
+        }
+        input.noticed_us = monotonic_us();
+        if(!spsc_push(&stages->input, &input))
+        {
+            stages->dropped_input++;
+            continue;
+        }
+        spsc_doorbell_ring(&stages->sim_bell);
+        if(input.kind == INPUT_QUIT)
+        {
+            break;
+        }
+    }
+    return NULL;
+}
+
+// The only thread that touches ncurses once the pipeline is running. A slow terminal only
+// delays this thread, and frames it was too slow for are skipped rather than queued.
+static void *render_thread(void *arg)
+{
+    program_data    *data    = (program_data *)arg;
+    thread_pipeline *stages  = &data->pipeline;
+    spsc_ring *const rings[] = {&stages->render};
+
+    while(!atomic_load(&stages->stop))
+    {
+        render_frame frame;
+        render_frame newest;
+        bool         have_frame = false;
+
+        while(spsc_pop(&stages->render, &frame))
+        {
+            newest     = frame;
+            have_frame = true;
+        }
+        if(have_frame)
+        {
+            draw_frame(data->win, &newest);
+        }
+        spsc_doorbell_wait(&stages->render_bell, rings, 1, -1);
+    }
+    return NULL;
+}
+
+static void draw_frame(WINDOW *win, const render_frame *frame)
+{
+    wclear(win);
+    mvwprintw(win, frame->remote_y, frame->remote_x, "@");
+    mvwprintw(win, frame->local_y, frame->local_x, "*");
+    box(win, ZERO, ZERO);    // borders
+    if(frame->invalid_move)
+    {
+        mvprintw(LINES + 1, 0, "INVALID MOVE                              ");    // the line needs to be this long to clear the other text
+    }
+    else
+    {
+        mvprintw(LINES + 1, 0, "Hit arrow keys or your controller to move.");
     }
+    wnoutrefresh(stdscr);
+    wnoutrefresh(win);
+    doupdate();
 }
 
 // Free up allocated resources before exiting
 void cleanup(program_data *data)
 {
+    pipeline_stop(data);
     if(data->win)
     {
         endwin();
@@ -916,7 +2245,11 @@ void cleanup(program_data *data)
     {
         SDL_GameControllerClose(data->controller);
     }
+    sdl_render_close(&data->sdl);
 #endif
+    net_backend_close(&data->net);
+    spectate_publisher_close(&data->spectate);
+    state_export_close(&data->shared_state);
     if(data->local_udp_socket >= 0)
     {
         close(data->local_udp_socket);
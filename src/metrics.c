@@ -0,0 +1,492 @@
+#include "metrics.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define METRICS_TEXT_MAX 16384
+#define METRICS_REQUEST_MAX 1024
+#define METRICS_CLIENT_TIMEOUT_MS 1000
+#define METRICS_BACKLOG 4
+#define MICROS_PER_SEC 1000000.0
+#define MILLIS_PER_SEC 1000
+#define NANOS_PER_MILLI 1000000L
+
+static void    bump(atomic_uint_least64_t *value, uint64_t n);
+static size_t  append(char *out, size_t cap, size_t len, const char *format, ...) __attribute__((format(printf, 4, 5)));
+static void   *exporter(void *arg);
+static void    serve_client(metrics_registry *reg, int client);
+static void    write_file(metrics_registry *reg);
+static bool    send_all(int sock, const char *buf, size_t len);
+static int     open_listener(in_port_t port);
+static int64_t monotonic_ms(void);
+
+// Upper bounds of the latency buckets, from well under a frame to a quarter of a second
+static const int64_t bucket_bounds_us[METRICS_BUCKETS] = {50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000};
+
+static const char *const counter_names[METRIC_COUNTERS] = {
+    "game_packets_sent_total",
+    "game_packets_received_total",
+    "game_invalid_moves_total",
+    "game_timer_moves_total",
+    "game_socket_errors_total",
+    "game_moves_coalesced_total",
+};
+
+static const char *const counter_help[METRIC_COUNTERS] = {
+    "Datagrams sent to the peer.",
+    "Datagrams received from the socket, before filtering.",
+    "Moves rejected for leaving the board.",
+    "Random moves made because no key was pressed in time.",
+    "Failed sends, receives and waits on the peer socket.",
+    "Local moves folded into a later update instead of sent on their own.",
+};
+
+static const char *const histogram_names[METRIC_HISTOGRAMS] = {
+    "game_move_latency_seconds",
+    "game_packet_latency_seconds",
+    "game_peer_rtt_seconds",
+};
+
+static const char *const histogram_help[METRIC_HISTOGRAMS] = {
+    "Time from a key press or timer move being noticed to the move being sent.",
+    "Time from a datagram being received to the board being updated.",
+    "Time from sending a snapshot or delta to receiving the peer's ack.",
+};
+
+// state_names[i] labels transitions into state i, as passed to metrics_transition()
+void metrics_init(metrics_registry *reg, const char *const *state_names, int state_count)
+{
+    memset(reg, 0, sizeof(*reg));
+    atomic_init(&reg->count, 0);
+    reg->state_names = state_names;
+    reg->state_count = state_count < METRICS_STATES ? state_count : METRICS_STATES;
+    reg->listen_sock = -1;
+    reg->stop_fds[0] = -1;
+    reg->stop_fds[1] = -1;
+}
+
+// Hands the calling thread a shard of its own. Returns NULL once every shard is taken.
+metrics_shard *metrics_register(metrics_registry *reg)
+{
+    int index = atomic_fetch_add(&reg->count, 1);
+
+    if(index >= METRICS_SHARDS)
+    {
+        atomic_fetch_sub(&reg->count, 1);
+        return NULL;
+    }
+    return &reg->shards[index];
+}
+
+void metrics_count(metrics_shard *shard, int counter)
+{
+    if(shard != NULL)
+    {
+        bump(&shard->counters[counter], 1);
+    }
+}
+
+void metrics_transition(metrics_shard *shard, int state)
+{
+    if(shard != NULL && state >= 0 && state < METRICS_STATES)
+    {
+        bump(&shard->transitions[state], 1);
+    }
+}
+
+void metrics_observe_us(metrics_shard *shard, int histogram, int64_t us)
+{
+    metrics_histogram *h;
+    int                bucket = 0;
+
+    if(shard == NULL)
+    {
+        return;
+    }
+    if(us < 0)
+    {
+        us = 0;
+    }
+    while(bucket < METRICS_BUCKETS && us > bucket_bounds_us[bucket])
+    {
+        bucket++;
+    }
+    h = &shard->histograms[histogram];
+    bump(&h->buckets[bucket], 1);
+    bump(&h->sum_us, (uint64_t)us);
+}
+
+// One counter summed over every thread's shard
+uint64_t metrics_total(metrics_registry *reg, int counter)
+{
+    int      shards = atomic_load(&reg->count);
+    uint64_t total  = 0;
+
+    for(int s = 0; s < shards; s++)
+    {
+        total += atomic_load_explicit(&reg->shards[s].counters[counter], memory_order_relaxed);
+    }
+    return total;
+}
+
+// Sums every shard into Prometheus text exposition format. Returns the length, or 0 if cap is too small.
+size_t metrics_format(metrics_registry *reg, char *out, size_t cap)
+{
+    int    shards = atomic_load(&reg->count);
+    size_t len    = 0;
+
+    for(int c = 0; c < METRIC_COUNTERS; c++)
+    {
+        len = append(out, cap, len, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", counter_names[c], counter_help[c], counter_names[c], counter_names[c], (unsigned long long)metrics_total(reg, c));
+    }
+
+    len = append(out, cap, len, "# HELP game_fsm_transitions_total State machine transitions, by the state entered.\n# TYPE game_fsm_transitions_total counter\n");
+    for(int state = 0; state < reg->state_count; state++)
+    {
+        uint64_t total = 0;
+
+        for(int s = 0; s < shards; s++)
+        {
+            total += atomic_load_explicit(&reg->shards[s].transitions[state], memory_order_relaxed);
+        }
+        len = append(out, cap, len, "game_fsm_transitions_total{state=\"%s\"} %llu\n", reg->state_names[state], (unsigned long long)total);
+    }
+
+    for(int hist = 0; hist < METRIC_HISTOGRAMS; hist++)
+    {
+        uint64_t cumulative = 0;
+        uint64_t sum_us     = 0;
+
+        len = append(out, cap, len, "# HELP %s %s\n# TYPE %s histogram\n", histogram_names[hist], histogram_help[hist], histogram_names[hist]);
+        for(int b = 0; b <= METRICS_BUCKETS; b++)
+        {
+            for(int s = 0; s < shards; s++)
+            {
+                cumulative += atomic_load_explicit(&reg->shards[s].histograms[hist].buckets[b], memory_order_relaxed);
+            }
+            if(b < METRICS_BUCKETS)
+            {
+                len = append(out, cap, len, "%s_bucket{le=\"%g\"} %llu\n", histogram_names[hist], (double)bucket_bounds_us[b] / MICROS_PER_SEC, (unsigned long long)cumulative);
+            }
+            else
+            {
+                len = append(out, cap, len, "%s_bucket{le=\"+Inf\"} %llu\n", histogram_names[hist], (unsigned long long)cumulative);
+            }
+        }
+        for(int s = 0; s < shards; s++)
+        {
+            sum_us += atomic_load_explicit(&reg->shards[s].histograms[hist].sum_us, memory_order_relaxed);
+        }
+        len = append(out, cap, len, "%s_sum %.6f\n%s_count %llu\n", histogram_names[hist], (double)sum_us / MICROS_PER_SEC, histogram_names[hist], (unsigned long long)cumulative);
+    }
+    return len < cap ? len : 0;
+}
+
+// Serves 127.0.0.1:port/metrics when port is not 0, and rewrites path every METRICS_FILE_INTERVAL_MS
+// when path is not NULL, from a thread of its own so a slow scraper never holds up the game
+int metrics_export_start(metrics_registry *reg, in_port_t port, const char *path)
+{
+    if(port == 0 && path == NULL)
+    {
+        return 0;
+    }
+    if(path != NULL)
+    {
+        if(strlen(path) >= sizeof(reg->path))
+        {
+            fprintf(stderr, "Metrics file path is too long\n");
+            return -1;
+        }
+        strcpy(reg->path, path);
+    }
+    if(port != 0)
+    {
+        reg->listen_sock = open_listener(port);
+        if(reg->listen_sock < 0)
+        {
+            return -1;
+        }
+    }
+    if(pipe(reg->stop_fds) < 0)
+    {
+        perror("pipe");
+        goto fail;
+    }
+    if(pthread_create(&reg->thread, NULL, exporter, reg) != 0)
+    {
+        perror("pthread_create");
+        goto fail;
+    }
+    reg->running = true;
+    return 0;
+
+fail:
+    if(reg->stop_fds[0] >= 0)
+    {
+        close(reg->stop_fds[0]);
+        close(reg->stop_fds[1]);
+        reg->stop_fds[0] = -1;
+        reg->stop_fds[1] = -1;
+    }
+    if(reg->listen_sock >= 0)
+    {
+        close(reg->listen_sock);
+        reg->listen_sock = -1;
+    }
+    return -1;
+}
+
+// Stops the exporter thread, leaving the file with the final counts; safe to call more than once
+void metrics_export_stop(metrics_registry *reg)
+{
+    const char stop = 1;
+
+    if(!reg->running)
+    {
+        return;
+    }
+    if(write(reg->stop_fds[1], &stop, 1) < 0)
+    {
+        perror("write");
+    }
+    pthread_join(reg->thread, NULL);
+    reg->running = false;
+    close(reg->stop_fds[0]);
+    close(reg->stop_fds[1]);
+    reg->stop_fds[0] = -1;
+    reg->stop_fds[1] = -1;
+    if(reg->listen_sock >= 0)
+    {
+        close(reg->listen_sock);
+        reg->listen_sock = -1;
+    }
+    if(reg->path[0] != '\0')
+    {
+        write_file(reg);
+    }
+}
+
+// Each shard has a single writer, so a relaxed load and store is enough. Unlike atomic_fetch_add
+// both compile to plain moves, with no lock prefix, while still being well defined for the reader.
+static void bump(atomic_uint_least64_t *value, uint64_t n)
+{
+    atomic_store_explicit(value, atomic_load_explicit(value, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+// snprintf that keeps track of the length; once the buffer is full it only keeps counting
+static size_t append(char *out, size_t cap, size_t len, const char *format, ...)
+{
+    va_list args;
+    int     n;
+
+    va_start(args, format);
+    n = vsnprintf(len < cap ? out + len : NULL, len < cap ? cap - len : 0, format, args);
+    va_end(args);
+    return n < 0 ? len : len + (size_t)n;
+}
+
+static void *exporter(void *arg)
+{
+    metrics_registry *reg        = (metrics_registry *)arg;
+    int64_t           next_write = monotonic_ms();
+
+    for(;;)
+    {
+        struct pollfd fds[2];
+        nfds_t        count   = 1;
+        int           timeout = -1;
+
+        fds[0].fd      = reg->stop_fds[0];
+        fds[0].events  = POLLIN;
+        fds[0].revents = 0;
+        if(reg->listen_sock >= 0)
+        {
+            fds[1].fd      = reg->listen_sock;
+            fds[1].events  = POLLIN;
+            fds[1].revents = 0;
+            count          = 2;
+        }
+        if(reg->path[0] != '\0')
+        {
+            int64_t wait = next_write - monotonic_ms();
+
+            timeout = wait > 0 ? (int)wait : 0;
+        }
+
+        if(poll(fds, count, timeout) < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            perror("poll");
+            break;
+        }
+        if(fds[0].revents & POLLIN)
+        {
+            break;
+        }
+        if(count == 2 && (fds[1].revents & POLLIN))
+        {
+            int client = accept(reg->listen_sock, NULL, NULL);
+
+            if(client >= 0)
+            {
+                serve_client(reg, client);
+                close(client);
+            }
+        }
+        if(reg->path[0] != '\0' && monotonic_ms() >= next_write)
+        {
+            write_file(reg);
+            next_write = monotonic_ms() + METRICS_FILE_INTERVAL_MS;
+        }
+    }
+    return NULL;
+}
+
+// Answers one request and closes the connection, so no keep-alive state is needed
+static void serve_client(metrics_registry *reg, int client)
+{
+    char          request[METRICS_REQUEST_MAX];
+    char          body[METRICS_TEXT_MAX];
+    char          header[METRICS_REQUEST_MAX];
+    struct pollfd fd;
+    ssize_t       bytes;
+    size_t        body_len;
+    int           header_len;
+
+    fd.fd      = client;
+    fd.events  = POLLIN;
+    fd.revents = 0;
+    if(poll(&fd, 1, METRICS_CLIENT_TIMEOUT_MS) <= 0)
+    {
+        return;
+    }
+    bytes = recv(client, request, sizeof(request) - 1, 0);
+    if(bytes <= 0)
+    {
+        return;
+    }
+    request[bytes] = '\0';
+
+    if(strncmp(request, "GET /metrics ", strlen("GET /metrics ")) != 0 && strncmp(request, "GET / ", strlen("GET / ")) != 0)
+    {
+        static const char not_found[] = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+
+        send_all(client, not_found, sizeof(not_found) - 1);
+        return;
+    }
+
+    body_len   = metrics_format(reg, body, sizeof(body));
+    header_len = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n", body_len);
+    if(send_all(client, header, (size_t)header_len))
+    {
+        send_all(client, body, body_len);
+    }
+}
+
+// Written beside the target and renamed over it, so a reader such as node_exporter's textfile
+// collector never sees half a file
+static void write_file(metrics_registry *reg)
+{
+    char   body[METRICS_TEXT_MAX];
+    char   tmp[METRICS_PATH_MAX + sizeof(".tmp")];
+    size_t body_len;
+    FILE  *file;
+
+    body_len = metrics_format(reg, body, sizeof(body));
+    snprintf(tmp, sizeof(tmp), "%s.tmp", reg->path);
+    file = fopen(tmp, "w");    // NOLINT(android-cloexec-fopen)
+    if(file == NULL)
+    {
+        perror("fopen");
+        return;
+    }
+    if(fwrite(body, 1, body_len, file) != body_len)
+    {
+        perror("fwrite");
+        fclose(file);
+        unlink(tmp);
+        return;
+    }
+    if(fclose(file) != 0 || rename(tmp, reg->path) != 0)
+    {
+        perror("rename");
+        unlink(tmp);
+    }
+}
+
+static bool send_all(int sock, const char *buf, size_t len)
+{
+    while(len > 0)
+    {
+        ssize_t sent = send(sock, buf, len, MSG_NOSIGNAL);
+
+        if(sent < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        buf += sent;
+        len -= (size_t)sent;
+    }
+    return true;
+}
+
+// Only listens on loopback: the endpoint has no authentication, so reaching it from elsewhere
+// means going through something on this host, such as a local Prometheus or an SSH tunnel
+static int open_listener(in_port_t port)
+{
+    struct sockaddr_in addr;
+    int                sock;
+    int                reuse = 1;
+
+    sock = socket(AF_INET, SOCK_STREAM, 0);    // NOLINT(android-cloexec-socket)
+    if(sock < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+    if(setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0)
+    {
+        perror("setsockopt SO_REUSEADDR");
+        goto fail;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror("bind metrics");
+        goto fail;
+    }
+    if(listen(sock, METRICS_BACKLOG) < 0)
+    {
+        perror("listen");
+        goto fail;
+    }
+    return sock;
+
+fail:
+    close(sock);
+    return -1;
+}
+
+static int64_t monotonic_ms(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * MILLIS_PER_SEC + now.tv_nsec / NANOS_PER_MILLI;
+}
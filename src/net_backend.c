@@ -0,0 +1,587 @@
+#include "net_backend.h"
+#include <errno.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+    #include <linux/io_uring.h>
+    #include <poll.h>
+    #include <sys/mman.h>
+    #include <sys/syscall.h>
+#endif
+
+#define NET_OP_SHIFT 16
+#define NET_OP_RECV 1U
+#define NET_OP_SEND 2U
+#define NET_OP_POLL 3U
+#define NET_SLOT_MASK 0xFFFFU
+#define NANOS_PER_SEC 1000000000L
+#define MILLIS_PER_SEC 1000
+#define MICROS_PER_MILLI 1000
+#define NANOS_PER_MILLI 1000000L
+#define NET_URING_SUBMIT_TRIES 4
+
+static int     classic_wait(net_backend *net, int extra_fd, int timeout_ms);
+static int     classic_send(net_backend *net, const void *buf, size_t len);
+static ssize_t classic_recv(net_backend *net, void *buf, size_t cap, struct sockaddr_storage *from, socklen_t *from_len);
+#ifdef __linux__
+static int                  uring_open(net_backend *net);
+static void                 uring_close(net_backend *net);
+static int                  uring_enter(net_backend *net, unsigned min_complete, unsigned flags, const struct io_uring_getevents_arg *arg);
+static struct io_uring_sqe *uring_get_sqe(net_backend *net, uint64_t user_data);
+static int                  uring_post_recv(net_backend *net, unsigned slot);
+static void                 uring_reap(net_backend *net);
+static int                  uring_wait(net_backend *net, int extra_fd, int timeout_ms);
+static int                  uring_send(net_backend *net, const void *buf, size_t len);
+static ssize_t              uring_recv(net_backend *net, void *buf, size_t cap, struct sockaddr_storage *from, socklen_t *from_len);
+#endif
+
+// Falls back to the classic backend when io_uring is requested but unavailable; returns the backend in use
+int net_backend_open(net_backend *net, int backend, int sock, const struct sockaddr_storage *remote_addr, socklen_t remote_addr_len)
+{
+    memset(net, 0, sizeof(*net));
+    net->backend = NET_BACKEND_CLASSIC;
+    net->sock    = sock;
+    if(remote_addr != NULL)
+    {
+        memcpy(&net->remote_addr, remote_addr, sizeof(net->remote_addr));
+        net->remote_addr_len = remote_addr_len;
+    }
+#ifdef __linux__
+    net->ring_fd = -1;
+    if(backend == NET_BACKEND_URING && uring_open(net) == 0)
+    {
+        net->backend = NET_BACKEND_URING;
+    }
+#else
+    (void)backend;
+#endif
+    return net->backend;
+}
+
+// Blocks until a datagram or extra_fd (if >= 0) is readable; returns a NET_READY_* mask, 0 on timeout, -1 on error
+int net_backend_wait(net_backend *net, int extra_fd, int timeout_ms)
+{
+#ifdef __linux__
+    if(net->backend == NET_BACKEND_URING)
+    {
+        return uring_wait(net, extra_fd, timeout_ms);
+    }
+#endif
+    return classic_wait(net, extra_fd, timeout_ms);
+}
+
+// The classic backend sends immediately; io_uring queues the send until the next wait or flush
+int net_backend_send(net_backend *net, const void *buf, size_t len)
+{
+#ifdef __linux__
+    if(net->backend == NET_BACKEND_URING)
+    {
+        return uring_send(net, buf, len);
+    }
+#endif
+    return classic_send(net, buf, len);
+}
+
+// Submits queued io_uring work without waiting; a no-op for the classic backend
+int net_backend_flush(net_backend *net)
+{
+#ifdef __linux__
+    if(net->backend == NET_BACKEND_URING && *net->sq_tail != __atomic_load_n(net->sq_head, __ATOMIC_ACQUIRE))
+    {
+        return uring_enter(net, 0, 0, NULL) < 0 ? -1 : 0;
+    }
+#else
+    (void)net;
+#endif
+    return 0;
+}
+
+// Only call after net_backend_wait reported NET_READY_PACKET
+ssize_t net_backend_recv(net_backend *net, void *buf, size_t cap, struct sockaddr_storage *from, socklen_t *from_len)
+{
+#ifdef __linux__
+    if(net->backend == NET_BACKEND_URING)
+    {
+        return uring_recv(net, buf, cap, from, from_len);
+    }
+#endif
+    return classic_recv(net, buf, cap, from, from_len);
+}
+
+// Tears down the ring; the socket belongs to the caller
+void net_backend_close(net_backend *net)
+{
+#ifdef __linux__
+    if(net->backend == NET_BACKEND_URING)
+    {
+        uring_close(net);
+    }
+#endif
+    net->backend = NET_BACKEND_CLASSIC;
+}
+
+const char *net_backend_name(int backend)
+{
+    return backend == NET_BACKEND_URING ? "io_uring" : "classic";
+}
+
+static int classic_wait(net_backend *net, int extra_fd, int timeout_ms)
+{
+    fd_set         read_fds;
+    struct timeval timeout;
+    int            nfds;
+    int            retval;
+    int            ready = 0;
+
+    FD_ZERO(&read_fds);
+    FD_SET((long unsigned int)net->sock, &read_fds);
+    nfds = net->sock;
+    if(extra_fd >= 0)
+    {
+        FD_SET((long unsigned int)extra_fd, &read_fds);
+        nfds = extra_fd > nfds ? extra_fd : nfds;
+    }
+    timeout.tv_sec  = timeout_ms / MILLIS_PER_SEC;
+    timeout.tv_usec = (timeout_ms % MILLIS_PER_SEC) * MICROS_PER_MILLI;
+
+    net->syscalls++;
+    retval = select(nfds + 1, &read_fds, NULL, NULL, &timeout);
+    if(retval <= 0)
+    {
+        return retval;
+    }
+    if(FD_ISSET((long unsigned int)net->sock, &read_fds))
+    {
+        ready |= NET_READY_PACKET;
+    }
+    if(extra_fd >= 0 && FD_ISSET((long unsigned int)extra_fd, &read_fds))
+    {
+        ready |= NET_READY_EXTRA;
+    }
+    return ready;
+}
+
+static int classic_send(net_backend *net, const void *buf, size_t len)
+{
+    net->syscalls++;
+    if(sendto(net->sock, buf, len, 0, (struct sockaddr *)&net->remote_addr, net->remote_addr_len) < 0)
+    {
+        net->errors++;
+        return -1;
+    }
+    net->sent++;
+    return 0;
+}
+
+static ssize_t classic_recv(net_backend *net, void *buf, size_t cap, struct sockaddr_storage *from, socklen_t *from_len)
+{
+    ssize_t bytes;
+
+    *from_len = sizeof(*from);
+    net->syscalls++;
+    bytes = recvfrom(net->sock, buf, cap, 0, (struct sockaddr *)from, from_len);
+    if(bytes < 0)
+    {
+        net->errors++;
+        return -1;
+    }
+    net->received++;
+    return bytes;
+}
+
+#ifdef __linux__
+
+// Maps the rings by hand (no liburing dependency) and pre-posts every receive buffer
+static int uring_open(net_backend *net)
+{
+    struct io_uring_params params;
+    int                    fd;
+
+    memset(&params, 0, sizeof(params));
+    fd = (int)syscall(__NR_io_uring_setup, NET_URING_ENTRIES, &params);
+    if(fd < 0)
+    {
+        return -1;
+    }
+    net->ring_fd = fd;
+
+    // Waiting with a timeout in the same call as the submit needs IORING_ENTER_EXT_ARG (5.11)
+    if(!(params.features & IORING_FEAT_EXT_ARG))
+    {
+        uring_close(net);
+        return -1;
+    }
+
+    net->sq_ring_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    net->cq_ring_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if(params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        net->sq_ring_len = net->sq_ring_len > net->cq_ring_len ? net->sq_ring_len : net->cq_ring_len;
+    }
+    net->sq_ring = mmap(NULL, net->sq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if(net->sq_ring == MAP_FAILED)
+    {
+        net->sq_ring = NULL;
+        uring_close(net);
+        return -1;
+    }
+    if(params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        net->cq_ring = net->sq_ring;
+    }
+    else
+    {
+        net->cq_ring = mmap(NULL, net->cq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if(net->cq_ring == MAP_FAILED)
+        {
+            net->cq_ring = NULL;
+            uring_close(net);
+            return -1;
+        }
+    }
+    net->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    net->sqes     = (struct io_uring_sqe *)mmap(NULL, net->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if(net->sqes == MAP_FAILED)
+    {
+        net->sqes = NULL;
+        uring_close(net);
+        return -1;
+    }
+
+    // The kernel reports offsets into the ring, and places every field at its natural alignment
+    net->sq_head    = (unsigned *)(void *)((char *)net->sq_ring + params.sq_off.head);
+    net->sq_tail    = (unsigned *)(void *)((char *)net->sq_ring + params.sq_off.tail);
+    net->sq_mask    = (unsigned *)(void *)((char *)net->sq_ring + params.sq_off.ring_mask);
+    net->sq_array   = (unsigned *)(void *)((char *)net->sq_ring + params.sq_off.array);
+    net->sq_entries = params.sq_entries;
+    net->cq_head    = (unsigned *)(void *)((char *)net->cq_ring + params.cq_off.head);
+    net->cq_tail    = (unsigned *)(void *)((char *)net->cq_ring + params.cq_off.tail);
+    net->cq_mask    = (unsigned *)(void *)((char *)net->cq_ring + params.cq_off.ring_mask);
+    net->cqes       = (struct io_uring_cqe *)(void *)((char *)net->cq_ring + params.cq_off.cqes);
+    net->send_free  = (1U << NET_URING_SEND_SLOTS) - 1U;
+
+    for(unsigned slot = 0; slot < NET_URING_RECV_SLOTS; slot++)
+    {
+        if(uring_post_recv(net, slot) != 0)
+        {
+            uring_close(net);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void uring_close(net_backend *net)
+{
+    if(net->sqes != NULL)
+    {
+        munmap(net->sqes, net->sqes_len);
+        net->sqes = NULL;
+    }
+    if(net->cq_ring != NULL && net->cq_ring != net->sq_ring)
+    {
+        munmap(net->cq_ring, net->cq_ring_len);
+    }
+    net->cq_ring = NULL;
+    if(net->sq_ring != NULL)
+    {
+        munmap(net->sq_ring, net->sq_ring_len);
+        net->sq_ring = NULL;
+    }
+    if(net->ring_fd >= 0)
+    {
+        close(net->ring_fd);
+        net->ring_fd = -1;
+    }
+}
+
+// One io_uring_enter submits everything queued and optionally waits for completions
+static int uring_enter(net_backend *net, unsigned min_complete, unsigned flags, const struct io_uring_getevents_arg *arg)
+{
+    unsigned to_submit;
+
+    to_submit = *net->sq_tail - __atomic_load_n(net->sq_head, __ATOMIC_ACQUIRE);
+    net->syscalls++;
+    return (int)syscall(__NR_io_uring_enter, net->ring_fd, to_submit, min_complete, flags, arg, arg != NULL ? sizeof(*arg) : 0);
+}
+
+// Queues an SQE; the kernel only picks it up on the next enter. When the ring is full this submits
+// to make room, and returns NULL if the kernel still has not taken the oldest entry off the ring,
+// since writing the slot then would overwrite an SQE that was never submitted.
+static struct io_uring_sqe *uring_get_sqe(net_backend *net, uint64_t user_data)
+{
+    struct io_uring_sqe *sqe;
+    unsigned             tail;
+    unsigned             index;
+
+    tail = *net->sq_tail;
+    for(int tries = 0; tail - __atomic_load_n(net->sq_head, __ATOMIC_ACQUIRE) >= net->sq_entries; tries++)
+    {
+        if(tries == NET_URING_SUBMIT_TRIES)
+        {
+            errno = EBUSY;
+            return NULL;
+        }
+        // EAGAIN and EBUSY are the kernel asking us to come back; anything else will not clear up
+        if(uring_enter(net, 0, 0, NULL) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+        {
+            return NULL;
+        }
+    }
+    index                = tail & *net->sq_mask;
+    sqe                  = &net->sqes[index];
+    net->sq_array[index] = index;
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = user_data;
+    __atomic_store_n(net->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    return sqe;
+}
+
+// A buffer that cannot be posted because the ring is full is remembered and posted by the next wait
+static int uring_post_recv(net_backend *net, unsigned slot)
+{
+    net_slot            *recv_slot = &net->recv_slots[slot];
+    struct io_uring_sqe *sqe;
+
+    recv_slot->iov.iov_base = recv_slot->buf;
+    recv_slot->iov.iov_len  = sizeof(recv_slot->buf);
+    memset(&recv_slot->msg, 0, sizeof(recv_slot->msg));
+    recv_slot->msg.msg_name    = &recv_slot->addr;
+    recv_slot->msg.msg_namelen = sizeof(recv_slot->addr);
+    recv_slot->msg.msg_iov     = &recv_slot->iov;
+    recv_slot->msg.msg_iovlen  = 1;
+
+    sqe = uring_get_sqe(net, ((uint64_t)NET_OP_RECV << NET_OP_SHIFT) | slot);
+    if(sqe == NULL)
+    {
+        net->errors++;
+        net->recv_unposted |= 1U << slot;
+        return -1;
+    }
+    net->recv_unposted &= ~(1U << slot);
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd     = net->sock;
+    sqe->addr   = (uint64_t)(uintptr_t)&recv_slot->msg;
+    sqe->len    = 1;
+    return 0;
+}
+
+// Drains the completion queue; receives are kept in arrival order until net_backend_recv picks them up
+static void uring_reap(net_backend *net)
+{
+    unsigned head;
+    unsigned tail;
+
+    head = *net->cq_head;
+    tail = __atomic_load_n(net->cq_tail, __ATOMIC_ACQUIRE);
+    while(head != tail)
+    {
+        const struct io_uring_cqe *cqe  = &net->cqes[head & *net->cq_mask];
+        unsigned                   op   = (unsigned)(cqe->user_data >> NET_OP_SHIFT);
+        unsigned                   slot = (unsigned)(cqe->user_data & NET_SLOT_MASK);
+
+        if(op == NET_OP_RECV)
+        {
+            if(cqe->res >= 0)
+            {
+                unsigned tail_index = (net->ready_head + net->ready_count) % NET_URING_RECV_SLOTS;
+
+                net->recv_slots[slot].len = (size_t)cqe->res;
+                net->ready[tail_index]    = slot;
+                net->ready_count++;
+            }
+            else
+            {
+                net->errors++;
+                uring_post_recv(net, slot);
+            }
+        }
+        else if(op == NET_OP_SEND)
+        {
+            if(cqe->res < 0)
+            {
+                net->errors++;
+            }
+            net->send_free |= 1U << slot;
+        }
+        else if(op == NET_OP_POLL)
+        {
+            // A failed poll says nothing about the fd; it is re-armed on the next wait
+            net->poll_armed = false;
+            if(cqe->res < 0)
+            {
+                net->errors++;
+            }
+            else
+            {
+                net->extra_ready = true;
+            }
+        }
+        head++;
+    }
+    __atomic_store_n(net->cq_head, head, __ATOMIC_RELEASE);
+}
+
+// Sends, re-posted receives, the stdin poll and the wait itself all go through a single io_uring_enter
+static int uring_wait(net_backend *net, int extra_fd, int timeout_ms)
+{
+    struct timespec deadline;
+
+    while(net->recv_unposted != 0)
+    {
+        if(uring_post_recv(net, (unsigned)__builtin_ctz(net->recv_unposted)) != 0)
+        {
+            break;
+        }
+    }
+    if(extra_fd >= 0 && !net->poll_armed)
+    {
+        struct io_uring_sqe *sqe;
+
+        sqe = uring_get_sqe(net, (uint64_t)NET_OP_POLL << NET_OP_SHIFT);
+        if(sqe == NULL)
+        {
+            net->errors++;
+            return -1;
+        }
+        sqe->opcode        = IORING_OP_POLL_ADD;
+        sqe->fd            = extra_fd;
+        sqe->poll32_events = POLLIN;
+        net->poll_armed    = true;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ms / MILLIS_PER_SEC;
+    deadline.tv_nsec += (long)(timeout_ms % MILLIS_PER_SEC) * NANOS_PER_MILLI;
+    if(deadline.tv_nsec >= NANOS_PER_SEC)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= NANOS_PER_SEC;
+    }
+
+    for(;;)
+    {
+        struct timespec               now;
+        struct __kernel_timespec      remaining;
+        struct io_uring_getevents_arg arg;
+        int                           ready = 0;
+
+        if(net->ready_count > 0)
+        {
+            ready |= NET_READY_PACKET;
+        }
+        if(net->extra_ready)
+        {
+            ready |= NET_READY_EXTRA;
+        }
+        if(ready != 0)
+        {
+            net->extra_ready = false;
+            return net_backend_flush(net) < 0 ? -1 : ready;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        remaining.tv_sec  = deadline.tv_sec - now.tv_sec;
+        remaining.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+        if(remaining.tv_nsec < 0)
+        {
+            remaining.tv_sec--;
+            remaining.tv_nsec += NANOS_PER_SEC;
+        }
+        if(remaining.tv_sec < 0)
+        {
+            return net_backend_flush(net) < 0 ? -1 : 0;
+        }
+
+        memset(&arg, 0, sizeof(arg));
+        arg.ts = (uint64_t)(uintptr_t)&remaining;
+        if(uring_enter(net, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg) < 0 && errno != ETIME)
+        {
+            return -1;
+        }
+        uring_reap(net);
+    }
+}
+
+static int uring_send(net_backend *net, const void *buf, size_t len)
+{
+    net_slot            *send_slot;
+    struct io_uring_sqe *sqe;
+    unsigned             slot;
+
+    if(len > NET_PACKET_MAX)
+    {
+        errno = EMSGSIZE;
+        net->errors++;
+        return -1;
+    }
+
+    // Every send buffer is still owned by the kernel, so submit and wait for one to come back
+    while(net->send_free == 0)
+    {
+        if(uring_enter(net, 1, IORING_ENTER_GETEVENTS, NULL) < 0 && errno != EINTR)
+        {
+            net->errors++;
+            return -1;
+        }
+        uring_reap(net);
+    }
+
+    slot = (unsigned)__builtin_ctz(net->send_free);
+    net->send_free &= ~(1U << slot);
+
+    send_slot = &net->send_slots[slot];
+    memcpy(send_slot->buf, buf, len);
+    send_slot->iov.iov_base = send_slot->buf;
+    send_slot->iov.iov_len  = len;
+    memset(&send_slot->msg, 0, sizeof(send_slot->msg));
+    send_slot->msg.msg_name    = &net->remote_addr;
+    send_slot->msg.msg_namelen = net->remote_addr_len;
+    send_slot->msg.msg_iov     = &send_slot->iov;
+    send_slot->msg.msg_iovlen  = 1;
+
+    sqe = uring_get_sqe(net, ((uint64_t)NET_OP_SEND << NET_OP_SHIFT) | slot);
+    if(sqe == NULL)
+    {
+        net->send_free |= 1U << slot;
+        net->errors++;
+        return -1;
+    }
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd     = net->sock;
+    sqe->addr   = (uint64_t)(uintptr_t)&send_slot->msg;
+    sqe->len    = 1;
+    net->sent++;
+    return 0;
+}
+
+// Copies out the oldest completed receive and re-posts its buffer with the next submit
+static ssize_t uring_recv(net_backend *net, void *buf, size_t cap, struct sockaddr_storage *from, socklen_t *from_len)
+{
+    const net_slot *recv_slot;
+    unsigned        slot;
+    size_t          len;
+
+    if(net->ready_count == 0)
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+    slot            = net->ready[net->ready_head];
+    net->ready_head = (net->ready_head + 1) % NET_URING_RECV_SLOTS;
+    net->ready_count--;
+
+    recv_slot = &net->recv_slots[slot];
+    len       = recv_slot->len < cap ? recv_slot->len : cap;
+    memcpy(buf, recv_slot->buf, len);
+    memcpy(from, &recv_slot->addr, sizeof(*from));
+    *from_len = recv_slot->msg.msg_namelen;
+    uring_post_recv(net, slot);
+    net->received++;
+    return (ssize_t)len;
+}
+
+#endif
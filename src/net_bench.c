@@ -0,0 +1,203 @@
+#include "net_backend.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_MOVES 100000
+#define WAIT_TIMEOUT 2000
+#define PER_MOVES 1000.0
+#define MICROS_PER_SEC 1000000.0
+#define MILLIS_PER_SEC 1000.0
+#define NANOS_PER_MILLI 1000000.0
+
+// One side of the loopback exchange
+typedef struct
+{
+    net_backend net;
+    int         sock;
+    long        moves;
+    int         failed;
+} bench_peer;
+
+static int    bind_loopback(struct sockaddr_storage *addr, socklen_t *addr_len);
+static void  *echo_peer(void *arg);
+static double cpu_micros(void);
+static int    run_backend(int backend, long moves);
+
+// Measures the syscalls and CPU a player spends per thousand moves, where each move is a datagram
+// out and an acknowledgement back, just like move_local() and apply_sync() exchange them
+int main(int argc, char *argv[])
+{
+    long moves = DEFAULT_MOVES;
+
+    if(argc > 1)
+    {
+        moves = strtol(argv[1], NULL, 10);    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+        if(moves <= 0)
+        {
+            fprintf(stderr, "Usage: %s [moves]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    printf("%-10s %10s %12s %18s %18s\n", "backend", "moves", "wall ms", "syscalls/1k moves", "cpu us/1k moves");
+    if(run_backend(NET_BACKEND_CLASSIC, moves) != 0 || run_backend(NET_BACKEND_URING, moves) != 0)
+    {
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+static int bind_loopback(struct sockaddr_storage *addr, socklen_t *addr_len)
+{
+    struct sockaddr_in *ipv4_addr = (struct sockaddr_in *)addr;
+    int                 sock;
+
+    memset(addr, 0, sizeof(*addr));
+    ipv4_addr->sin_family      = AF_INET;
+    ipv4_addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ipv4_addr->sin_port        = 0;
+    *addr_len                  = sizeof(*ipv4_addr);
+
+    sock = socket(AF_INET, SOCK_DGRAM, 0);    // NOLINT(android-cloexec-socket)
+    if(sock < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+    if(bind(sock, (struct sockaddr *)addr, *addr_len) < 0 || getsockname(sock, (struct sockaddr *)addr, addr_len) < 0)
+    {
+        perror("bind");
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+// Acknowledges every datagram it receives, standing in for the remote player
+static void *echo_peer(void *arg)
+{
+    bench_peer *peer = (bench_peer *)arg;
+
+    for(long i = 0; i < peer->moves; i++)
+    {
+        struct sockaddr_storage from;
+        socklen_t               from_len;
+        uint8_t                 buf[NET_PACKET_MAX];
+        ssize_t                 bytes;
+
+        if(net_backend_wait(&peer->net, -1, WAIT_TIMEOUT) <= 0)
+        {
+            peer->failed = 1;
+            break;
+        }
+        bytes = net_backend_recv(&peer->net, buf, sizeof(buf), &from, &from_len);
+        if(bytes < 0 || net_backend_send(&peer->net, buf, (size_t)bytes) < 0)
+        {
+            peer->failed = 1;
+            break;
+        }
+    }
+    net_backend_flush(&peer->net);
+    return NULL;
+}
+
+static double cpu_micros(void)
+{
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+    return (double)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * MICROS_PER_SEC + (double)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+}
+
+static int run_backend(int backend, long moves)
+{
+    bench_peer              player;
+    bench_peer              echo;
+    struct sockaddr_storage player_addr;
+    struct sockaddr_storage echo_addr;
+    socklen_t               player_len;
+    socklen_t               echo_len;
+    pthread_t               thread;
+    struct timespec         start;
+    struct timespec         end;
+    double                  cpu_start;
+    double                  cpu_used;
+    double                  wall_ms;
+    const uint8_t           move[] = {'D', 0, 1, 0, 0, 1, 2};
+    int                     used;
+
+    memset(&player, 0, sizeof(player));
+    memset(&echo, 0, sizeof(echo));
+    player.sock = bind_loopback(&player_addr, &player_len);
+    echo.sock   = bind_loopback(&echo_addr, &echo_len);
+    if(player.sock < 0 || echo.sock < 0)
+    {
+        return -1;
+    }
+    player.moves = moves;
+    echo.moves   = moves;
+    used         = net_backend_open(&player.net, backend, player.sock, &echo_addr, echo_len);
+    net_backend_open(&echo.net, backend, echo.sock, &player_addr, player_len);
+    if(used != backend)
+    {
+        printf("%-10s unavailable, skipped\n", net_backend_name(backend));
+        net_backend_close(&player.net);
+        net_backend_close(&echo.net);
+        close(player.sock);
+        close(echo.sock);
+        return 0;
+    }
+
+    cpu_start = cpu_micros();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if(pthread_create(&thread, NULL, echo_peer, &echo) != 0)
+    {
+        perror("pthread_create");
+        return -1;
+    }
+
+    for(long i = 0; i < moves; i++)
+    {
+        struct sockaddr_storage from;
+        socklen_t               from_len;
+        uint8_t                 buf[NET_PACKET_MAX];
+
+        if(net_backend_send(&player.net, move, sizeof(move)) < 0 || net_backend_wait(&player.net, -1, WAIT_TIMEOUT) <= 0 || net_backend_recv(&player.net, buf, sizeof(buf), &from, &from_len) < 0)
+        {
+            player.failed = 1;
+            break;
+        }
+    }
+    pthread_join(thread, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    cpu_used = cpu_micros() - cpu_start;
+    wall_ms  = (double)(end.tv_sec - start.tv_sec) * MILLIS_PER_SEC + (double)(end.tv_nsec - start.tv_nsec) / NANOS_PER_MILLI;
+
+    if(player.failed || echo.failed)
+    {
+        fprintf(stderr, "%s: lost a datagram or timed out\n", net_backend_name(backend));
+    }
+    else
+    {
+        printf("%-10s %10ld %12.1f %18.1f %18.1f\n",
+               net_backend_name(backend),
+               moves,
+               wall_ms,
+               (double)(player.net.syscalls + echo.net.syscalls) * PER_MOVES / (double)moves,
+               cpu_used * PER_MOVES / (double)moves);
+    }
+
+    net_backend_close(&player.net);
+    net_backend_close(&echo.net);
+    close(player.sock);
+    close(echo.sock);
+    return player.failed || echo.failed ? -1 : 0;
+}
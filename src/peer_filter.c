@@ -0,0 +1,110 @@
+#include "peer_filter.h"
+#include <netinet/in.h>
+#include <string.h>
+#include <time.h>
+
+#define MILLI 1000U
+#define NANOS_PER_SEC 1000000000LL
+#define NANOS_PER_MILLI 1000000LL
+
+static int64_t now_ns(void);
+
+// rate is datagrams per second per peer, burst is how many may arrive back to back
+void peer_filter_init(peer_filter *filter, uint32_t rate, uint32_t burst)
+{
+    memset(filter, 0, sizeof(*filter));
+    filter->rate  = rate;
+    filter->burst = burst > 0 ? burst : 1;
+}
+
+// Registers a sender we expect traffic from; every other source is dropped
+int peer_filter_add(peer_filter *filter, const struct sockaddr_storage *addr)
+{
+    peer_entry *peer;
+
+    if(filter->count == PEER_FILTER_MAX)
+    {
+        return -1;
+    }
+    peer = &filter->peers[filter->count++];
+    memcpy(&peer->addr, addr, sizeof(peer->addr));
+    peer->tokens_milli   = (uint64_t)filter->burst * MILLI;
+    peer->last_refill_ns = now_ns();
+    return 0;
+}
+
+// Returns one of the PEER_* verdicts and counts it
+int peer_filter_check(peer_filter *filter, const struct sockaddr_storage *from)
+{
+    for(int i = 0; i < filter->count; i++)
+    {
+        peer_entry *peer = &filter->peers[i];
+        int64_t     now;
+        uint64_t    cap;
+
+        if(!peer_same_address(&peer->addr, from))
+        {
+            continue;
+        }
+
+        // Refill for the time since the last datagram: rate tokens per second is rate thousandths per millisecond
+        now = now_ns();
+        cap = (uint64_t)filter->burst * MILLI;
+        peer->tokens_milli += (uint64_t)(now - peer->last_refill_ns) * filter->rate / NANOS_PER_MILLI;
+        peer->last_refill_ns = now;
+        if(peer->tokens_milli > cap)
+        {
+            peer->tokens_milli = cap;
+        }
+        if(peer->tokens_milli < MILLI)
+        {
+            filter->counters.dropped_rate++;
+            return PEER_DROP_RATE;
+        }
+        peer->tokens_milli -= MILLI;
+        filter->counters.accepted++;
+        return PEER_ACCEPT;
+    }
+    filter->counters.dropped_unknown++;
+    return PEER_DROP_UNKNOWN;
+}
+
+// Moves a datagram that passed peer_filter_check but failed the caller's shape checks from accepted to malformed
+void peer_filter_count_malformed(peer_filter *filter)
+{
+    filter->counters.accepted--;
+    filter->counters.dropped_malformed++;
+}
+
+// Compares family, address and port, ignoring padding and IPv6 flow info. The spectator view uses it
+// to tell players apart too.
+bool peer_same_address(const struct sockaddr_storage *a, const struct sockaddr_storage *b)
+{
+    if(a->ss_family != b->ss_family)
+    {
+        return false;
+    }
+    if(a->ss_family == AF_INET)
+    {
+        const struct sockaddr_in *a4 = (const struct sockaddr_in *)a;
+        const struct sockaddr_in *b4 = (const struct sockaddr_in *)b;
+
+        return a4->sin_port == b4->sin_port && a4->sin_addr.s_addr == b4->sin_addr.s_addr;
+    }
+    if(a->ss_family == AF_INET6)
+    {
+        const struct sockaddr_in6 *a6 = (const struct sockaddr_in6 *)a;
+        const struct sockaddr_in6 *b6 = (const struct sockaddr_in6 *)b;
+
+        return a6->sin6_port == b6->sin6_port && memcmp(&a6->sin6_addr, &b6->sin6_addr, sizeof(a6->sin6_addr)) == 0;
+    }
+    return false;
+}
+
+static int64_t now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * NANOS_PER_SEC + now.tv_nsec;
+}
@@ -0,0 +1,189 @@
+#include "sdl_render.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define DEFAULT_FRAMES 600
+#define PACED_FPS 60
+#define PACED_MILLIS 1000
+#define PACED_TOLERANCE_PERCENT 20
+#define MAX_MOVERS 256
+#define MILLIS_PER_SEC 1000.0
+#define NANOS_PER_MILLI 1000000.0
+
+// A board size and how many players move on it every frame
+typedef struct
+{
+    int cols;
+    int lines;
+    int tile_px;
+    int movers;
+} bench_case;
+
+static double now_ms(void);
+static void   step_movers(sdl_renderer *r, int *xs, int *ys, int movers, unsigned *seed);
+static int    run_case(const bench_case *c, long frames, bool full);
+static int    run_paced(void);
+
+// Compares drawing only the changed tiles against repainting the whole board, then checks that
+// frame pacing holds a steady rate. Runs headless under the dummy video driver unless told otherwise.
+int main(int argc, char *argv[])
+{
+    static const bench_case cases[] = {
+        {40,  40,  16, 2         },
+        {40,  40,  16, 64        },
+        {120, 67,  16, 2         },
+        {120, 67,  16, MAX_MOVERS},
+        {240, 135, 8,  2         },
+        {240, 135, 8,  MAX_MOVERS},
+    };
+    long frames = DEFAULT_FRAMES;
+
+    if(argc > 1)
+    {
+        frames = strtol(argv[1], NULL, 10);    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+        if(frames <= 0)
+        {
+            fprintf(stderr, "Usage: %s [frames]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    setenv("SDL_VIDEODRIVER", "dummy", 0);
+
+    printf("%-12s %7s %7s %12s %14s\n", "board", "movers", "mode", "ms/frame", "tiles/frame");
+    for(size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        if(run_case(&cases[i], frames, false) != 0 || run_case(&cases[i], frames, true) != 0)
+        {
+            return EXIT_FAILURE;
+        }
+    }
+    return run_paced() == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static double now_ms(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec * MILLIS_PER_SEC + (double)now.tv_nsec / NANOS_PER_MILLI;
+}
+
+// Moves every player one tile in a random direction, staying inside the walls
+static void step_movers(sdl_renderer *r, int *xs, int *ys, int movers, unsigned *seed)
+{
+    for(int i = 0; i < movers; i++)
+    {
+        int x = xs[i];
+        int y = ys[i];
+
+        switch(rand_r(seed) % 4)
+        {
+            case 0:
+                x--;
+                break;
+            case 1:
+                x++;
+                break;
+            case 2:
+                y--;
+                break;
+            default:
+                y++;
+                break;
+        }
+        if(x < 1 || y < 1 || x >= r->cols - 1 || y >= r->lines - 1)
+        {
+            continue;
+        }
+        sdl_render_set(r, xs[i], ys[i], TILE_EMPTY);
+        sdl_render_set(r, x, y, i == 0 ? TILE_LOCAL : TILE_REMOTE);
+        xs[i] = x;
+        ys[i] = y;
+    }
+}
+
+static int run_case(const bench_case *c, long frames, bool full)
+{
+    sdl_renderer r;
+    int          xs[MAX_MOVERS];
+    int          ys[MAX_MOVERS];
+    unsigned     seed = 1;
+    double       start;
+    double       elapsed;
+    uint64_t     tiles_before;
+    char         board[16];
+
+    if(sdl_render_open(&r, "render_bench", c->cols, c->lines, c->tile_px, 0) != 0)
+    {
+        return -1;
+    }
+    sdl_render_border(&r);
+    for(int i = 0; i < c->movers; i++)
+    {
+        xs[i] = 1 + (int)((unsigned)rand_r(&seed) % (unsigned)(c->cols - 2));
+        ys[i] = 1 + (int)((unsigned)rand_r(&seed) % (unsigned)(c->lines - 2));
+        sdl_render_set(&r, xs[i], ys[i], i == 0 ? TILE_LOCAL : TILE_REMOTE);
+    }
+    sdl_render_frame(&r);
+
+    tiles_before = r.tiles_drawn;
+    start        = now_ms();
+    for(long f = 0; f < frames; f++)
+    {
+        step_movers(&r, xs, ys, c->movers, &seed);
+        if(full)
+        {
+            sdl_render_invalidate(&r);
+        }
+        sdl_render_frame(&r);
+    }
+    elapsed = now_ms() - start;
+
+    snprintf(board, sizeof(board), "%dx%d", c->cols, c->lines);
+    printf("%-12s %7d %7s %12.3f %14.1f\n", board, c->movers, full ? "full" : "dirty", elapsed / (double)frames, (double)(r.tiles_drawn - tiles_before) / (double)frames);
+    sdl_render_close(&r);
+    return 0;
+}
+
+// Changes a tile as fast as possible for a second and counts how many frames actually get presented.
+// Fails if that is more than PACED_TOLERANCE_PERCENT away from the requested rate.
+static int run_paced(void)
+{
+    const long   expected = (long)PACED_FPS * PACED_MILLIS / (long)MILLIS_PER_SEC;
+    sdl_renderer r;
+    int          xs[1] = {1};
+    int          ys[1] = {1};
+    unsigned     seed  = 1;
+    double       start;
+    uint64_t     frames_before;
+    long         presented;
+
+    if(sdl_render_open(&r, "render_bench", 40, 40, 16, PACED_FPS) != 0)    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    {
+        return -1;
+    }
+    sdl_render_border(&r);
+    sdl_render_frame(&r);
+
+    frames_before = r.frames;
+    start         = now_ms();
+    while(now_ms() - start < PACED_MILLIS)
+    {
+        struct timespec nap = {0, 0};
+
+        step_movers(&r, xs, ys, 1, &seed);
+        sdl_render_frame(&r);
+        nap.tv_nsec = (long)sdl_render_timeout(&r, PACED_MILLIS) * (long)NANOS_PER_MILLI;
+        nanosleep(&nap, NULL);
+    }
+    presented = (long)(r.frames - frames_before);
+    sdl_render_close(&r);
+    printf("paced at %d fps: %ld frames presented in %d ms, expected %ld\n", PACED_FPS, presented, PACED_MILLIS, expected);
+    if(labs(presented - expected) * 100 > expected * PACED_TOLERANCE_PERCENT)    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    {
+        fprintf(stderr, "frame pacing is off by more than %d%%\n", PACED_TOLERANCE_PERCENT);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,264 @@
+#include "rollback.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LEAD_LIMIT 127
+
+static void     catch_up(rollback_session *rb);
+static void     run_frame(rollback_session *rb, uint32_t frame);
+static uint8_t *snapshot(const rollback_session *rb, uint32_t frame);
+static int32_t  frame_advantage(const rollback_session *rb);
+static bool     frame_newer(uint32_t a, uint32_t b);
+static void     put_u32(uint8_t *out, uint32_t value);
+static uint32_t get_u32(const uint8_t *in);
+
+// state is the caller's live game state and is stepped in place. local_player (0 or 1) is where this
+// side's input goes in the array step receives. Usually the peers take opposite indices so both see the
+// players in the same order. If step treats the players alike and they never interact, each side may
+// instead put itself first (both pass 0), provided state also lists the local player first. Both peers
+// must use the same delay. The first delay frames run with no input from either side, which is what
+// each peer sends for them.
+int rollback_init(rollback_session *rb, uint8_t *state, size_t state_size, rollback_step_fn step, void *ctx, int local_player, uint32_t delay)
+{
+    memset(rb, 0, sizeof(*rb));
+    if(local_player < 0 || local_player >= ROLLBACK_PLAYERS || delay > ROLLBACK_MAX_DELAY || state_size == 0)
+    {
+        errno = EINVAL;
+        perror("rollback_init");
+        return -1;
+    }
+    rb->snapshots = (uint8_t *)malloc(ROLLBACK_WINDOW * state_size);
+    if(rb->snapshots == NULL)
+    {
+        perror("rollback_init");
+        return -1;
+    }
+    rb->state        = state;
+    rb->state_size   = state_size;
+    rb->step         = step;
+    rb->ctx          = ctx;
+    rb->local_player = local_player;
+    rb->delay        = delay;
+    for(uint32_t frame = 0; frame < delay; frame++)
+    {
+        rb->local[frame].frame = frame;
+        rb->local[frame].known = true;
+        rb->local[frame].input = ROLLBACK_INPUT_NONE;
+    }
+    return 0;
+}
+
+void rollback_destroy(rollback_session *rb)
+{
+    free(rb->snapshots);
+    rb->snapshots = NULL;
+}
+
+// Called once per tick with the input gathered since the last one. Returns false, leaving the input
+// for the next tick, when running this frame would mean predicting too far ahead of the remote, or
+// when we are far enough ahead of it that idling a frame lets it catch up. Any pending rollback is
+// done either way, so the state is never left showing a prediction we know to be wrong.
+bool rollback_advance(rollback_session *rb, uint8_t local_input)
+{
+    rollback_input *slot;
+
+    catch_up(rb);
+    // Also waits rather than overwrite an input the remote has not confirmed, which we may still have to resend
+    if((int32_t)(rb->frame - rb->confirmed) >= ROLLBACK_MAX_PREDICTION || rb->frame + rb->delay - rb->remote_ack >= ROLLBACK_INPUT_RING ||
+       frame_advantage(rb) >= ROLLBACK_SYNC_LEAD)
+    {
+        rb->stalls++;
+        return false;
+    }
+    slot        = &rb->local[(rb->frame + rb->delay) % ROLLBACK_INPUT_RING];
+    slot->frame = rb->frame + rb->delay;
+    slot->known = true;
+    slot->input = local_input;
+    run_frame(rb, rb->frame);
+    rb->frame++;
+    return true;
+}
+
+// Records the remote player's input for a frame. If that frame already ran on a prediction that
+// turned out wrong, the next advance rolls back to it.
+void rollback_add_remote(rollback_session *rb, uint32_t frame, uint8_t input)
+{
+    rollback_input *slot;
+
+    // Everything before confirmed is already known, and anything a full ring ahead cannot be stored
+    if(frame_newer(rb->confirmed, frame) || frame - rb->confirmed >= ROLLBACK_INPUT_RING)
+    {
+        return;
+    }
+    slot = &rb->remote[frame % ROLLBACK_INPUT_RING];
+    if(slot->known && slot->frame == frame)
+    {
+        return;
+    }
+    slot->frame = frame;
+    slot->known = true;
+    slot->input = input;
+    if(frame_newer(rb->frame, frame) && rb->used[frame % ROLLBACK_INPUT_RING] != input)
+    {
+        rb->mispredictions++;
+        if(!rb->rollback_pending || frame_newer(rb->rollback_from, frame))
+        {
+            rb->rollback_from = frame;
+        }
+        rb->rollback_pending = true;
+    }
+    while(rb->remote[rb->confirmed % ROLLBACK_INPUT_RING].known && rb->remote[rb->confirmed % ROLLBACK_INPUT_RING].frame == rb->confirmed)
+    {
+        rb->confirmed++;
+    }
+}
+
+// Layout: tag, our frame, how far we think we lead the remote, the remote's inputs we have confirmed,
+// first input frame, count, inputs. Sent every tick with every input the remote has not confirmed,
+// so a lost datagram costs nothing once the next one arrives.
+size_t rollback_encode_inputs(const rollback_session *rb, uint8_t *out, size_t cap)
+{
+    uint32_t scheduled;
+    uint32_t count;
+    uint32_t first;
+    int32_t  lead = 0;
+
+    scheduled = rb->frame + rb->delay;
+    count     = scheduled - rb->remote_ack < ROLLBACK_MSG_INPUTS ? scheduled - rb->remote_ack : ROLLBACK_MSG_INPUTS;
+    first     = scheduled - count;
+    if(cap < ROLLBACK_MSG_HEADER + count)
+    {
+        return 0;
+    }
+    if(rb->has_remote)
+    {
+        lead = (int32_t)(rb->frame - rb->remote_frame);
+        lead = lead > LEAD_LIMIT ? LEAD_LIMIT : (lead < -LEAD_LIMIT ? -LEAD_LIMIT : lead);
+    }
+    out[0] = ROLLBACK_MSG_INPUT;
+    put_u32(&out[1], rb->frame);
+    out[5] = (uint8_t)(int8_t)lead;
+    put_u32(&out[6], rb->confirmed);
+    put_u32(&out[10], first);
+    out[14] = (uint8_t)count;
+    for(uint32_t i = 0; i < count; i++)
+    {
+        out[ROLLBACK_MSG_HEADER + i] = rb->local[(first + i) % ROLLBACK_INPUT_RING].input;
+    }
+    return ROLLBACK_MSG_HEADER + count;
+}
+
+// Returns the number of inputs carried, or -1 for a malformed message
+int rollback_decode_inputs(rollback_session *rb, const uint8_t *in, size_t in_len)
+{
+    uint32_t sender_frame;
+    uint32_t ack;
+    uint32_t first;
+    uint8_t  count;
+
+    if(!rollback_plausible(in, in_len))
+    {
+        return -1;
+    }
+    sender_frame = get_u32(&in[1]);
+    ack          = get_u32(&in[6]);
+    first        = get_u32(&in[10]);
+    count        = in[14];
+    // Reordered datagrams can carry an older ack; one for inputs we have not even scheduled is bogus
+    if(frame_newer(ack, rb->remote_ack) && !frame_newer(ack, rb->frame + rb->delay))
+    {
+        rb->remote_ack = ack;
+    }
+    if(!rb->has_remote || frame_newer(sender_frame, rb->remote_frame))
+    {
+        rb->remote_frame = sender_frame;
+        rb->remote_lead  = (int8_t)in[5];
+        rb->has_remote   = true;
+    }
+    for(uint8_t i = 0; i < count; i++)
+    {
+        rollback_add_remote(rb, first + i, in[ROLLBACK_MSG_HEADER + i]);
+    }
+    return count;
+}
+
+bool rollback_plausible(const uint8_t *in, size_t in_len)
+{
+    return in_len >= ROLLBACK_MSG_HEADER && in_len <= ROLLBACK_MSG_MAX && in[0] == ROLLBACK_MSG_INPUT && in_len == ROLLBACK_MSG_HEADER + (size_t)in[14];
+}
+
+// Restores the state saved before the earliest mispredicted frame and re-runs every frame since
+static void catch_up(rollback_session *rb)
+{
+    uint32_t depth;
+
+    if(!rb->rollback_pending)
+    {
+        return;
+    }
+    depth = rb->frame - rb->rollback_from;
+    memcpy(rb->state, snapshot(rb, rb->rollback_from), rb->state_size);
+    for(uint32_t frame = rb->rollback_from; frame != rb->frame; frame++)
+    {
+        run_frame(rb, frame);
+    }
+    rb->rollback_pending = false;
+    rb->rollbacks++;
+    rb->resimulated += depth;
+    if(depth > rb->deepest)
+    {
+        rb->deepest = depth;
+    }
+}
+
+// Saves the state, then steps it with the best inputs we have: ours are always known by now, and
+// the remote's missing ones are predicted as no input, since moves are single key presses
+static void run_frame(rollback_session *rb, uint32_t frame)
+{
+    const rollback_input *local  = &rb->local[frame % ROLLBACK_INPUT_RING];
+    const rollback_input *remote = &rb->remote[frame % ROLLBACK_INPUT_RING];
+    uint8_t               inputs[ROLLBACK_PLAYERS];
+
+    memcpy(snapshot(rb, frame), rb->state, rb->state_size);
+    inputs[rb->local_player]     = local->known && local->frame == frame ? local->input : ROLLBACK_INPUT_NONE;
+    inputs[1 - rb->local_player] = remote->known && remote->frame == frame ? remote->input : ROLLBACK_INPUT_NONE;
+    rb->used[frame % ROLLBACK_INPUT_RING] = inputs[1 - rb->local_player];
+    rb->step(rb->ctx, rb->state, inputs);
+}
+
+static uint8_t *snapshot(const rollback_session *rb, uint32_t frame)
+{
+    return &rb->snapshots[(frame % ROLLBACK_WINDOW) * rb->state_size];
+}
+
+// Each side's gap to the other includes the same one-way delay, so half their difference is how
+// many frames we are really ahead
+static int32_t frame_advantage(const rollback_session *rb)
+{
+    if(!rb->has_remote)
+    {
+        return 0;
+    }
+    return ((int32_t)(rb->frame - rb->remote_frame) - rb->remote_lead) / 2;
+}
+
+// Serial number comparison, as for sync sequence numbers
+static bool frame_newer(uint32_t a, uint32_t b)
+{
+    return (int32_t)(uint32_t)(a - b) > 0;
+}
+
+static void put_u32(uint8_t *out, uint32_t value)
+{
+    out[0] = (uint8_t)(value >> 24);    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    out[1] = (uint8_t)(value >> 16);    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    out[2] = (uint8_t)(value >> 8);    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    out[3] = (uint8_t)(value & 0xFF);    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+}
+
+static uint32_t get_u32(const uint8_t *in)
+{
+    return ((uint32_t)in[0] << 24) | ((uint32_t)in[1] << 16) | ((uint32_t)in[2] << 8) | (uint32_t)in[3];    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+}
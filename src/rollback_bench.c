@@ -0,0 +1,298 @@
+#include "entity.h"
+#include "rollback.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DEFAULT_FRAMES 240
+#define FRAME_BUDGET_MS (1000.0 / 60.0)
+#define FRAME_DT (1.0F / 60.0F)
+#define BOARD_MIN 1.0F
+#define BOARD_MAX 38.0F
+#define MAX_SPEED 20.0F
+#define PLAYER_RADIUS 0.5F
+#define MAX_HITS 64
+#define DIRECTIONS 4
+#define BYTES_PER_KB 1024.0
+#define MILLIS_PER_SEC 1000.0
+#define NANOS_PER_MILLI 1000000.0
+
+// The part of the state that is not entities. Both players' positions and their running hit
+// counts live in the same block as the entity arrays, so one memcpy saves or restores everything.
+typedef struct
+{
+    float    player[ROLLBACK_PLAYERS][2];
+    uint32_t hits[ROLLBACK_PLAYERS];
+} bench_header;
+
+// The state block and an entity_world whose arrays point into it. The entity count never changes
+// during a run, so the struct itself holds nothing a rollback would need to restore.
+typedef struct
+{
+    uint8_t      *state;
+    size_t        state_size;
+    bench_header *header;
+    entity_world  world;
+    size_t        hits[MAX_HITS];
+} bench_world;
+
+static double now_ms(void);
+static size_t align_up(size_t size);
+static float  random_between(unsigned *seed, float lo, float hi);
+static int    world_create(bench_world *bw, size_t count);
+static void   world_destroy(bench_world *bw);
+static void   step_world(void *ctx, uint8_t *state, const uint8_t *inputs);
+static int    run(size_t count, long frames, bool late, uint8_t **final, double *ms);
+static int    run_case(size_t count, long frames);
+
+// For worlds of increasing size, compares a frame whose remote input arrived on time with one where
+// it arrives ROLLBACK_MAX_PREDICTION frames late and always differs from the prediction, so every
+// frame restores a snapshot and re-runs the deepest rollback the session allows
+int main(int argc, char *argv[])
+{
+    static const size_t counts[] = {0, 1000, 10000, 50000, 100000, 250000};
+    long                frames   = DEFAULT_FRAMES;
+
+    if(argc > 1)
+    {
+        frames = strtol(argv[1], NULL, 10);    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+        if(frames <= ROLLBACK_MAX_PREDICTION)
+        {
+            fprintf(stderr, "Usage: %s [frames, more than %d]\n", argv[0], ROLLBACK_MAX_PREDICTION);
+            return EXIT_FAILURE;
+        }
+    }
+
+    printf("%10s %10s %12s %14s %12s %8s\n", "entities", "state KB", "frame ms", "rollback ms", "vs frame", "budget");
+    for(size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++)
+    {
+        if(run_case(counts[i], frames) != 0)
+        {
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+static double now_ms(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec * MILLIS_PER_SEC + (double)now.tv_nsec / NANOS_PER_MILLI;
+}
+
+static size_t align_up(size_t size)
+{
+    return (size + ENTITY_ALIGN - 1) / ENTITY_ALIGN * ENTITY_ALIGN;
+}
+
+static float random_between(unsigned *seed, float lo, float hi)
+{
+    int value = rand_r(seed);
+
+    return lo + (hi - lo) * ((float)value / (float)RAND_MAX);
+}
+
+// Lays out the header, then x, y, vx, vy and kind, each starting on a vector boundary
+static int world_create(bench_world *bw, size_t count)
+{
+    size_t   capacity;
+    size_t   floats;
+    unsigned seed = 1;
+
+    memset(bw, 0, sizeof(*bw));
+    capacity       = (count + ENTITY_LANES - 1) / ENTITY_LANES * ENTITY_LANES;
+    floats         = capacity * sizeof(float);
+    bw->state_size = align_up(sizeof(bench_header)) + (4 * floats) + align_up(capacity);
+    bw->state      = (uint8_t *)aligned_alloc(ENTITY_ALIGN, align_up(bw->state_size));
+    if(bw->state == NULL)
+    {
+        perror("aligned_alloc");
+        return -1;
+    }
+    memset(bw->state, 0, bw->state_size);
+    // Every part starts on an ENTITY_ALIGN boundary, so the casts through void * are safe
+    bw->header         = (bench_header *)(void *)bw->state;
+    bw->world.x        = (float *)(void *)(bw->state + align_up(sizeof(bench_header)));
+    bw->world.y        = bw->world.x + capacity;
+    bw->world.vx       = bw->world.y + capacity;
+    bw->world.vy       = bw->world.vx + capacity;
+    bw->world.kind     = (uint8_t *)(bw->world.vy + capacity);
+    bw->world.capacity = capacity;
+    bw->world.min_x    = BOARD_MIN;
+    bw->world.min_y    = BOARD_MIN;
+    bw->world.max_x    = BOARD_MAX;
+    bw->world.max_y    = BOARD_MAX;
+    for(int p = 0; p < ROLLBACK_PLAYERS; p++)
+    {
+        bw->header->player[p][0] = BOARD_MIN;
+        bw->header->player[p][1] = BOARD_MIN;
+    }
+    // A third of each kind, as in entity_bench; pickups sit still
+    for(size_t i = 0; i < count; i++)
+    {
+        uint8_t kind  = (uint8_t)(i % ENTITY_KINDS);
+        float   speed = kind == ENTITY_PICKUP ? 0.0F : MAX_SPEED;
+        float   x     = random_between(&seed, BOARD_MIN, BOARD_MAX);
+        float   y     = random_between(&seed, BOARD_MIN, BOARD_MAX);
+        float   vx    = random_between(&seed, -speed, speed);
+        float   vy    = random_between(&seed, -speed, speed);
+
+        entity_spawn(&bw->world, kind, x, y, vx, vy);
+    }
+    return 0;
+}
+
+static void world_destroy(bench_world *bw)
+{
+    free(bw->state);
+    memset(bw, 0, sizeof(*bw));
+}
+
+// One frame: each player steps one cell for its input, every entity moves, and each player counts
+// the entities touching it. Depends only on the state block and the inputs.
+static void step_world(void *ctx, uint8_t *state, const uint8_t *inputs)
+{
+    static const float moves[DIRECTIONS + 1][2] = {
+        {0.0F,  0.0F },
+        {0.0F,  -1.0F},
+        {1.0F,  0.0F },
+        {0.0F,  1.0F },
+        {-1.0F, 0.0F },
+    };
+    bench_world  *bw     = (bench_world *)ctx;
+    bench_header *header = (bench_header *)(void *)state;
+
+    for(int p = 0; p < ROLLBACK_PLAYERS; p++)
+    {
+        float x = header->player[p][0] + moves[inputs[p] % (DIRECTIONS + 1)][0];
+        float y = header->player[p][1] + moves[inputs[p] % (DIRECTIONS + 1)][1];
+
+        header->player[p][0] = x < BOARD_MIN ? BOARD_MIN : (x > BOARD_MAX ? BOARD_MAX : x);
+        header->player[p][1] = y < BOARD_MIN ? BOARD_MIN : (y > BOARD_MAX ? BOARD_MAX : y);
+    }
+    entity_step(&bw->world, FRAME_DT);
+    for(int p = 0; p < ROLLBACK_PLAYERS; p++)
+    {
+        header->hits[p] += (uint32_t)entity_collide(&bw->world, header->player[p][0], header->player[p][1], PLAYER_RADIUS, bw->hits, MAX_HITS);
+    }
+}
+
+// Runs frames ticks of a session. The remote input for each frame is delivered either just before
+// it runs or ROLLBACK_MAX_PREDICTION frames after; both runs see the same inputs in the end, so
+// their final states must be byte-for-byte equal. Hands back a copy of the final state.
+static int run(size_t count, long frames, bool late, uint8_t **final, double *ms)
+{
+    bench_world      bw;
+    rollback_session rb;
+    unsigned         local_seed  = 2;
+    unsigned         remote_seed = 3;
+    uint8_t         *remote;
+    double           start;
+    int              ret = -1;
+
+    memset(&bw, 0, sizeof(bw));
+    memset(&rb, 0, sizeof(rb));
+    remote = (uint8_t *)malloc((size_t)frames + 1);
+    if(remote == NULL || world_create(&bw, count) != 0 || rollback_init(&rb, bw.state, bw.state_size, step_world, &bw, 0, 0) != 0)
+    {
+        perror("run");
+        goto done;
+    }
+    // Never the no-input prediction, so every late input forces a rollback
+    for(long f = 0; f < frames; f++)
+    {
+        remote[f] = (uint8_t)(1 + (rand_r(&remote_seed) % DIRECTIONS));
+    }
+    remote[frames] = ROLLBACK_INPUT_NONE;
+
+    start = now_ms();
+    for(long f = 0; f < frames; f++)
+    {
+        if(!late)
+        {
+            rollback_add_remote(&rb, (uint32_t)f, remote[f]);
+        }
+        else if(f >= ROLLBACK_MAX_PREDICTION)
+        {
+            rollback_add_remote(&rb, (uint32_t)(f - ROLLBACK_MAX_PREDICTION), remote[f - ROLLBACK_MAX_PREDICTION]);
+        }
+        // No messages go anywhere, so stand in for a peer that has every one of our inputs
+        rb.remote_ack = rb.frame;
+        if(!rollback_advance(&rb, (uint8_t)(rand_r(&local_seed) % (DIRECTIONS + 1))))
+        {
+            fprintf(stderr, "frame %ld stalled\n", f);
+            goto done;
+        }
+    }
+    *ms = (now_ms() - start) / (double)frames;
+
+    // Hand over the inputs still in flight and run one more frame, which settles both runs the same way
+    for(long f = late ? frames - ROLLBACK_MAX_PREDICTION : frames; f <= frames; f++)
+    {
+        rollback_add_remote(&rb, (uint32_t)f, remote[f]);
+    }
+    rollback_advance(&rb, ROLLBACK_INPUT_NONE);
+    if(late && rb.deepest != ROLLBACK_MAX_PREDICTION)
+    {
+        fprintf(stderr, "expected %d-frame rollbacks, deepest was %u\n", ROLLBACK_MAX_PREDICTION, rb.deepest);
+        goto done;
+    }
+    *final = (uint8_t *)malloc(bw.state_size);
+    if(*final == NULL)
+    {
+        perror("malloc");
+        goto done;
+    }
+    memcpy(*final, bw.state, bw.state_size);
+    ret = 0;
+
+done:
+    rollback_destroy(&rb);
+    world_destroy(&bw);
+    free(remote);
+    return ret;
+}
+
+static int run_case(size_t count, long frames)
+{
+    bench_world sizing;
+    uint8_t    *on_time = NULL;
+    uint8_t    *late    = NULL;
+    double      frame_ms;
+    double      rollback_ms;
+    int         ret = -1;
+
+    if(world_create(&sizing, count) != 0)
+    {
+        return -1;
+    }
+    if(run(count, frames, false, &on_time, &frame_ms) != 0 || run(count, frames, true, &late, &rollback_ms) != 0)
+    {
+        goto done;
+    }
+    // Re-running frames from a restored snapshot must land exactly where running them once does
+    if(memcmp(on_time, late, sizing.state_size) != 0)
+    {
+        fprintf(stderr, "%zu entities: rolled-back state differs from the one that never mispredicted\n", count);
+        goto done;
+    }
+
+    // A late frame re-runs ROLLBACK_MAX_PREDICTION frames on top of its own
+    printf("%10zu %10.1f %12.4f %14.4f %11.1fx %8s\n",
+           count,
+           (double)sizing.state_size / BYTES_PER_KB,
+           frame_ms,
+           rollback_ms,
+           rollback_ms / frame_ms,
+           rollback_ms < FRAME_BUDGET_MS ? "ok" : "OVER");
+    ret = 0;
+
+done:
+    world_destroy(&sizing);
+    free(on_time);
+    free(late);
+    return ret;
+}
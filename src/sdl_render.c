@@ -0,0 +1,309 @@
+#include "sdl_render.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MILLIS_PER_SEC 1000U
+#define PLAYER_INSET_DIVISOR 4
+
+static const Uint32 tile_colours[TILE_KINDS] = {
+    0xFF101010,    // TILE_EMPTY
+    0xFF808080,    // TILE_WALL
+    0xFF40C040,    // TILE_LOCAL
+    0xFFC04040     // TILE_REMOTE
+};
+
+static void queue_tile(sdl_renderer *r, uint32_t index);
+static int  paint_tile(sdl_renderer *r, uint32_t index);
+static void pump_events(sdl_renderer *r);
+
+// Opens a cols x lines board of tile_px square tiles; fps of 0 presents every frame that has changes
+int sdl_render_open(sdl_renderer *r, const char *title, int cols, int lines, int tile_px, int fps)
+{
+    size_t count;
+
+    memset(r, 0, sizeof(*r));
+    r->cols    = cols;
+    r->lines   = lines;
+    r->tile_px = tile_px;
+    count      = (size_t)cols * (size_t)lines;
+
+    if(SDL_InitSubSystem(SDL_INIT_VIDEO) != 0)
+    {
+        fprintf(stderr, "SDL_InitSubSystem: %s\n", SDL_GetError());
+        return -1;
+    }
+
+    r->window = SDL_CreateWindow(title, SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, cols * tile_px, lines * tile_px, 0);
+    if(r->window == NULL)
+    {
+        fprintf(stderr, "SDL_CreateWindow: %s\n", SDL_GetError());
+        SDL_QuitSubSystem(SDL_INIT_VIDEO);
+        goto fail;
+    }
+
+    // The software renderer draws straight into the window surface, which keeps its contents between
+    // presents, so copying just the dirty tiles each frame is enough
+    r->renderer = SDL_CreateRenderer(r->window, -1, SDL_RENDERER_SOFTWARE);
+    if(r->renderer == NULL)
+    {
+        fprintf(stderr, "SDL_CreateRenderer: %s\n", SDL_GetError());
+        goto fail;
+    }
+
+    r->texture = SDL_CreateTexture(r->renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, cols * tile_px, lines * tile_px);
+    if(r->texture == NULL)
+    {
+        fprintf(stderr, "SDL_CreateTexture: %s\n", SDL_GetError());
+        goto fail;
+    }
+
+    r->tiles  = (uint8_t *)calloc(count, sizeof(*r->tiles));
+    r->drawn  = (uint8_t *)calloc(count, sizeof(*r->drawn));
+    r->queued = (uint8_t *)calloc(count, sizeof(*r->queued));
+    r->dirty  = (uint32_t *)calloc(count, sizeof(*r->dirty));
+    if(r->tiles == NULL || r->drawn == NULL || r->queued == NULL || r->dirty == NULL)
+    {
+        perror("calloc");
+        goto fail;
+    }
+
+    r->frame_ms      = fps > 0 ? MILLIS_PER_SEC / (uint32_t)fps : 0;
+    r->next_frame_at = SDL_GetTicks();
+    sdl_render_invalidate(r);
+    return 0;
+
+fail:
+    sdl_render_close(r);
+    return -1;
+}
+
+// Changes one tile; it is drawn on the next frame only if it differs from what is on screen
+void sdl_render_set(sdl_renderer *r, int x, int y, uint8_t tile)
+{
+    uint32_t index;
+
+    if(x < 0 || y < 0 || x >= r->cols || y >= r->lines || tile >= TILE_KINDS)
+    {
+        return;
+    }
+    index = (uint32_t)y * (uint32_t)r->cols + (uint32_t)x;
+    if(r->tiles[index] == tile)
+    {
+        return;
+    }
+    r->tiles[index] = tile;
+    queue_tile(r, index);
+}
+
+// Walls around the edge, matching box() on the ncurses board
+void sdl_render_border(sdl_renderer *r)
+{
+    for(int x = 0; x < r->cols; x++)
+    {
+        sdl_render_set(r, x, 0, TILE_WALL);
+        sdl_render_set(r, x, r->lines - 1, TILE_WALL);
+    }
+    for(int y = 1; y < r->lines - 1; y++)
+    {
+        sdl_render_set(r, 0, y, TILE_WALL);
+        sdl_render_set(r, r->cols - 1, y, TILE_WALL);
+    }
+}
+
+// Forgets what is on screen so the next frame repaints and copies every tile
+void sdl_render_invalidate(sdl_renderer *r)
+{
+    uint32_t count = (uint32_t)r->cols * (uint32_t)r->lines;
+
+    for(uint32_t i = 0; i < count; i++)
+    {
+        r->drawn[i] = TILE_UNDRAWN;
+        queue_tile(r, i);
+    }
+    r->full_copy = true;
+}
+
+// Handles window events, then presents a frame if any tile changed and the frame is due.
+// Returns true if a frame was presented.
+bool sdl_render_frame(sdl_renderer *r)
+{
+    uint32_t now;
+    uint32_t painted = 0;
+
+    pump_events(r);
+    now = SDL_GetTicks();
+    if(r->dirty_count == 0 || (int32_t)(now - r->next_frame_at) < 0)
+    {
+        return false;
+    }
+
+    for(uint32_t i = 0; i < r->dirty_count; i++)
+    {
+        uint32_t index = r->dirty[i];
+
+        r->queued[index] = 0;
+        if(r->tiles[index] == r->drawn[index])
+        {
+            // Changed and changed back before this frame
+            continue;
+        }
+        if(paint_tile(r, index) != 0)
+        {
+            // Start over with every tile on the next frame
+            memset(r->queued, 0, (size_t)r->cols * (size_t)r->lines);
+            r->dirty_count = 0;
+            sdl_render_invalidate(r);
+            return false;
+        }
+        if(!r->full_copy)
+        {
+            SDL_Rect rect;
+
+            rect.x = (int)(index % (uint32_t)r->cols) * r->tile_px;
+            rect.y = (int)(index / (uint32_t)r->cols) * r->tile_px;
+            rect.w = r->tile_px;
+            rect.h = r->tile_px;
+            SDL_RenderCopy(r->renderer, r->texture, &rect, &rect);
+        }
+        r->drawn[index] = r->tiles[index];
+        painted++;
+    }
+    r->dirty_count = 0;
+
+    if(r->full_copy)
+    {
+        SDL_RenderCopy(r->renderer, r->texture, NULL, NULL);
+        r->full_copy = false;
+    }
+    if(painted > 0)
+    {
+        SDL_RenderPresent(r->renderer);
+        r->frames++;
+        r->tiles_drawn += painted;
+    }
+
+    // Pace from the previous deadline, but never try to catch up on frames we were too busy to draw
+    r->next_frame_at += r->frame_ms;
+    if((int32_t)(now - r->next_frame_at) > 0)
+    {
+        r->next_frame_at = now;
+    }
+    return painted > 0;
+}
+
+// Shortens a wait so the caller wakes up in time for the next frame and to handle window events
+int sdl_render_timeout(const sdl_renderer *r, int timeout_ms)
+{
+    int32_t until_frame = (int32_t)(r->next_frame_at - SDL_GetTicks());
+    int32_t wait        = r->frame_ms > 0 ? (int32_t)r->frame_ms : 1;
+
+    if(r->dirty_count > 0)
+    {
+        wait = until_frame > 0 ? until_frame : 0;
+    }
+    return timeout_ms < 0 || wait < timeout_ms ? (int)wait : timeout_ms;
+}
+
+void sdl_render_close(sdl_renderer *r)
+{
+    if(r->texture)
+    {
+        SDL_DestroyTexture(r->texture);
+    }
+    if(r->renderer)
+    {
+        SDL_DestroyRenderer(r->renderer);
+    }
+    if(r->window)
+    {
+        SDL_DestroyWindow(r->window);
+        SDL_QuitSubSystem(SDL_INIT_VIDEO);
+    }
+    free(r->tiles);
+    free(r->drawn);
+    free(r->queued);
+    free(r->dirty);
+    memset(r, 0, sizeof(*r));
+}
+
+static void queue_tile(sdl_renderer *r, uint32_t index)
+{
+    if(r->queued[index] == 0)
+    {
+        r->queued[index]            = 1;
+        r->dirty[r->dirty_count++] = index;
+    }
+}
+
+// Writes one tile into the streaming texture. Locked texture memory is write-only, so every
+// pixel of the tile is written.
+static int paint_tile(sdl_renderer *r, uint32_t index)
+{
+    SDL_Rect rect;
+    void    *pixels;
+    int      pitch;
+    uint8_t  tile   = r->tiles[index];
+    Uint32   ground = tile_colours[tile == TILE_WALL ? TILE_WALL : TILE_EMPTY];
+    int      inset  = r->tile_px / PLAYER_INSET_DIVISOR;
+
+    rect.x = (int)(index % (uint32_t)r->cols) * r->tile_px;
+    rect.y = (int)(index / (uint32_t)r->cols) * r->tile_px;
+    rect.w = r->tile_px;
+    rect.h = r->tile_px;
+    if(SDL_LockTexture(r->texture, &rect, &pixels, &pitch) != 0)
+    {
+        fprintf(stderr, "SDL_LockTexture: %s\n", SDL_GetError());
+        return -1;
+    }
+
+    for(int y = 0; y < r->tile_px; y++)
+    {
+        // SDL hands back rows aligned for the texture format
+        Uint32 *row    = (Uint32 *)(void *)((uint8_t *)pixels + (size_t)y * (size_t)pitch);
+        bool    inside = y >= inset && y < r->tile_px - inset;
+
+        for(int x = 0; x < r->tile_px; x++)
+        {
+            // Players are a square inset in an empty tile
+            if((tile == TILE_LOCAL || tile == TILE_REMOTE) && inside && x >= inset && x < r->tile_px - inset)
+            {
+                row[x] = tile_colours[tile];
+            }
+            else
+            {
+                row[x] = ground;
+            }
+        }
+    }
+    SDL_UnlockTexture(r->texture);
+    return 0;
+}
+
+// Records the last arrow key pressed in the window and whether it was closed; a resized or
+// re-exposed window gets every tile repainted
+static void pump_events(sdl_renderer *r)
+{
+    SDL_Event event;
+
+    while(SDL_PollEvent(&event))
+    {
+        if(event.type == SDL_QUIT)
+        {
+            r->quit = true;
+        }
+        else if(event.type == SDL_KEYDOWN)
+        {
+            SDL_Keycode sym = event.key.keysym.sym;
+
+            if(sym == SDLK_UP || sym == SDLK_DOWN || sym == SDLK_LEFT || sym == SDLK_RIGHT)
+            {
+                r->key = sym;
+            }
+        }
+        else if(event.type == SDL_WINDOWEVENT && (event.window.event == SDL_WINDOWEVENT_EXPOSED || event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED))
+        {
+            sdl_render_invalidate(r);
+        }
+    }
+}
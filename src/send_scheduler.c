@@ -0,0 +1,55 @@
+#include "send_scheduler.h"
+#include <string.h>
+
+#define MICROS_PER_SEC 1000000
+#define MICROS_PER_MILLI 1000
+
+// rate_hz is the most updates per second the peer will get from us
+void send_scheduler_init(send_scheduler *sched, uint32_t rate_hz)
+{
+    memset(sched, 0, sizeof(*sched));
+    sched->interval_us = MICROS_PER_SEC / (rate_hz > 0 ? rate_hz : 1);
+}
+
+// Records a local move. noticed_us is when its input arrived; the first unsent move's time is kept
+// so the caller can tell how long the batch waited.
+void send_scheduler_queue(send_scheduler *sched, int64_t noticed_us)
+{
+    if(sched->pending)
+    {
+        sched->coalesced++;
+        return;
+    }
+    sched->pending          = true;
+    sched->pending_since_us = noticed_us;
+}
+
+// True when there is a move to send and a full interval has passed since the last send
+bool send_scheduler_due(const send_scheduler *sched, int64_t now_us)
+{
+    return sched->pending && (!sched->has_sent || now_us - sched->last_sent_us >= sched->interval_us);
+}
+
+void send_scheduler_sent(send_scheduler *sched, int64_t now_us)
+{
+    sched->pending      = false;
+    sched->has_sent     = true;
+    sched->last_sent_us = now_us;
+    sched->sent++;
+}
+
+// Shortens a wait so a pending move goes out as soon as its interval is up
+int send_scheduler_timeout(const send_scheduler *sched, int64_t now_us, int timeout_ms)
+{
+    int64_t wait_us;
+    int64_t wait_ms;
+
+    if(!sched->pending)
+    {
+        return timeout_ms;
+    }
+    wait_us = sched->has_sent ? sched->last_sent_us + sched->interval_us - now_us : 0;
+    // Rounded up, so the wait never ends just before the send is due and spins
+    wait_ms = wait_us > 0 ? (wait_us + MICROS_PER_MILLI - 1) / MICROS_PER_MILLI : 0;
+    return timeout_ms < 0 || wait_ms < timeout_ms ? (int)wait_ms : timeout_ms;
+}
@@ -0,0 +1,363 @@
+#include "peer_filter.h"
+#include "spectate.h"
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+static int              set_multicast_options(int sock, int family, const char *interface_ip);
+static void             send_update(spectate_publisher *pub, int64_t now_ms);
+static spectate_source *find_source(spectate_view *view, const struct sockaddr_storage *from, int *index);
+static int              free_mark(const spectate_view *view, int count);
+static bool             is_multicast(const struct sockaddr_storage *group);
+
+// interface_ip picks the IPv4 interface to send on, e.g. 127.0.0.1 to keep the match on this host;
+// NULL lets the routing table decide
+int spectate_publisher_open(spectate_publisher *pub, const struct sockaddr_storage *group, socklen_t group_len, const char *interface_ip)
+{
+    memset(pub, 0, sizeof(*pub));
+    pub->sock = -1;
+    if(!is_multicast(group))
+    {
+        fprintf(stderr, "Spectator group is not a multicast address\n");
+        return -1;
+    }
+    memcpy(&pub->group, group, sizeof(pub->group));
+    pub->group_len = group_len;
+
+    pub->sock = socket(group->ss_family, SOCK_DGRAM, 0);    // NOLINT(android-cloexec-socket)
+    if(pub->sock < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+    if(set_multicast_options(pub->sock, group->ss_family, interface_ip) != 0)
+    {
+        close(pub->sock);
+        pub->sock = -1;
+        return -1;
+    }
+    sync_init(&pub->sync);
+    return 0;
+}
+
+// Sends the new state to every spectator at once: a keyframe when one is due, otherwise a delta
+// against the last keyframe
+void spectate_publish(spectate_publisher *pub, const uint8_t *state, size_t len, int64_t now_ms)
+{
+    if(pub->sock < 0 || len > SYNC_STATE_MAX)
+    {
+        return;
+    }
+    memcpy(pub->state, state, len);
+    pub->state_len = len;
+    send_update(pub, now_ms);
+}
+
+// Repeats the current state as a keyframe when the board has been still for a whole keyframe interval
+void spectate_tick(spectate_publisher *pub, int64_t now_ms)
+{
+    if(pub->sock >= 0 && pub->state_len > 0 && now_ms >= pub->next_keyframe_ms)
+    {
+        send_update(pub, now_ms);
+    }
+}
+
+// Shortens a wait so the caller wakes up in time for the next keyframe
+int spectate_timeout(const spectate_publisher *pub, int64_t now_ms, int timeout_ms)
+{
+    int64_t wait;
+
+    if(pub->sock < 0 || pub->state_len == 0)
+    {
+        return timeout_ms;
+    }
+    wait = pub->next_keyframe_ms - now_ms;
+    if(wait < 0)
+    {
+        wait = 0;
+    }
+    return timeout_ms < 0 || wait < timeout_ms ? (int)wait : timeout_ms;
+}
+
+void spectate_publisher_close(spectate_publisher *pub)
+{
+    if(pub->sock >= 0)
+    {
+        close(pub->sock);
+        pub->sock = -1;
+    }
+}
+
+// Binds the group's port and joins the group; several spectators on one host can share the port
+int spectate_listen(const struct sockaddr_storage *group, socklen_t group_len, const char *interface_ip)
+{
+    int sock;
+    int reuse = 1;
+
+    if(!is_multicast(group))
+    {
+        fprintf(stderr, "Spectator group is not a multicast address\n");
+        return -1;
+    }
+    sock = socket(group->ss_family, SOCK_DGRAM, 0);    // NOLINT(android-cloexec-socket)
+    if(sock < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+    if(setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0)
+    {
+        perror("setsockopt SO_REUSEADDR");
+        goto fail;
+    }
+
+    // Bound to the group address itself, so unicast traffic to the same port is not picked up
+    if(bind(sock, (const struct sockaddr *)group, group_len) < 0)
+    {
+        perror("bind");
+        goto fail;
+    }
+
+    if(group->ss_family == AF_INET)
+    {
+        struct ip_mreq mreq;
+
+        memset(&mreq, 0, sizeof(mreq));
+        mreq.imr_multiaddr        = ((const struct sockaddr_in *)group)->sin_addr;
+        mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+        if(interface_ip != NULL && inet_pton(AF_INET, interface_ip, &mreq.imr_interface) != 1)
+        {
+            fprintf(stderr, "%s is not an IPv4 address\n", interface_ip);
+            goto fail;
+        }
+        if(setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0)
+        {
+            perror("setsockopt IP_ADD_MEMBERSHIP");
+            goto fail;
+        }
+    }
+    else
+    {
+        struct ipv6_mreq mreq;
+
+        memset(&mreq, 0, sizeof(mreq));
+        mreq.ipv6mr_multiaddr = ((const struct sockaddr_in6 *)group)->sin6_addr;
+        if(setsockopt(sock, IPPROTO_IPV6, IPV6_JOIN_GROUP, &mreq, sizeof(mreq)) < 0)
+        {
+            perror("setsockopt IPV6_JOIN_GROUP");
+            goto fail;
+        }
+    }
+    return sock;
+
+fail:
+    close(sock);
+    return -1;
+}
+
+void spectate_view_init(spectate_view *view)
+{
+    memset(view, 0, sizeof(*view));
+}
+
+// Applies one datagram from the group. Returns the index of the player whose state changed, or -1.
+int spectate_view_receive(spectate_view *view, const struct sockaddr_storage *from, const uint8_t *buf, size_t len, int64_t now_ms)
+{
+    spectate_source *source;
+    sync_message     msg;
+    int              index;
+    int              type;
+
+    // Checked before a slot is taken, so junk sent to the group cannot use up the slots
+    if(!sync_plausible(buf, len))
+    {
+        view->ignored++;
+        return -1;
+    }
+    source = find_source(view, from, &index);
+    if(source == NULL)
+    {
+        view->ignored++;
+        return -1;
+    }
+    source->last_heard_ms = now_ms;
+
+    type = sync_decode(&source->sync, buf, len, &msg);
+    if(type == -1 && buf[0] == SYNC_MSG_SNAPSHOT && ++source->stale_snapshots >= SPECTATE_STALE_RESET)
+    {
+        // Keyframes that keep looking older than what we have mean the player restarted from sequence 0
+        sync_init(&source->sync);
+        type = sync_decode(&source->sync, buf, len, &msg);
+    }
+
+    switch(type)
+    {
+        case SYNC_MSG_SNAPSHOT:
+        case SYNC_MSG_DELTA:
+            memcpy(source->state, msg.state, msg.len);
+            source->state_len       = msg.len;
+            source->has_state       = true;
+            source->stale_snapshots = 0;
+            view->updates++;
+            return index;
+        case SYNC_MISSING_BASELINE:
+            // Joined between keyframes; the next one is at most SPECTATE_KEYFRAME_MS away
+            view->missing_baseline++;
+            return -1;
+        default:
+            view->ignored++;
+            return -1;
+    }
+}
+
+// Forgets players that have not sent anything, not even a keyframe, for SPECTATE_EXPIRE_MS. A player
+// that restarts comes back from a new port, so this is what clears its old position.
+// Returns true if anyone was forgotten.
+bool spectate_view_expire(spectate_view *view, int64_t now_ms)
+{
+    bool expired = false;
+
+    for(int i = 0; i < view->count;)
+    {
+        if(now_ms - view->sources[i].last_heard_ms > SPECTATE_EXPIRE_MS)
+        {
+            memmove(&view->sources[i], &view->sources[i + 1], (size_t)(view->count - i - 1) * sizeof(view->sources[0]));
+            view->count--;
+            expired = true;
+            continue;
+        }
+        i++;
+    }
+    return expired;
+}
+
+// Keeps multicast on the local network and loops it back so spectators on this host see it too
+static int set_multicast_options(int sock, int family, const char *interface_ip)
+{
+    if(family == AF_INET)
+    {
+        unsigned char ttl  = 1;
+        unsigned char loop = 1;
+
+        if(setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) < 0 || setsockopt(sock, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) < 0)
+        {
+            perror("setsockopt IP_MULTICAST");
+            return -1;
+        }
+        if(interface_ip != NULL)
+        {
+            struct in_addr iface;
+
+            if(inet_pton(AF_INET, interface_ip, &iface) != 1)
+            {
+                fprintf(stderr, "%s is not an IPv4 address\n", interface_ip);
+                return -1;
+            }
+            if(setsockopt(sock, IPPROTO_IP, IP_MULTICAST_IF, &iface, sizeof(iface)) < 0)
+            {
+                perror("setsockopt IP_MULTICAST_IF");
+                return -1;
+            }
+        }
+    }
+    else
+    {
+        int          hops = 1;
+        unsigned int loop = 1;
+
+        if(setsockopt(sock, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &hops, sizeof(hops)) < 0 || setsockopt(sock, IPPROTO_IPV6, IPV6_MULTICAST_LOOP, &loop, sizeof(loop)) < 0)
+        {
+            perror("setsockopt IPV6_MULTICAST");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Deltas are against the last keyframe, so a keyframe has to go out before the sent history wraps
+static void send_update(spectate_publisher *pub, int64_t now_ms)
+{
+    uint8_t packet[SYNC_PACKET_MAX];
+    size_t  n;
+
+    if(now_ms >= pub->next_keyframe_ms || pub->since_keyframe >= SPECTATE_KEYFRAME_UPDATES)
+    {
+        n                     = sync_encode_keyframe(&pub->sync, pub->state, pub->state_len, packet, sizeof(packet));
+        pub->since_keyframe   = 0;
+        pub->next_keyframe_ms = now_ms + SPECTATE_KEYFRAME_MS;
+    }
+    else
+    {
+        n = sync_encode_update(&pub->sync, pub->state, pub->state_len, packet, sizeof(packet));
+        pub->since_keyframe++;
+    }
+    if(n == 0)
+    {
+        return;
+    }
+    if(sendto(pub->sock, packet, n, 0, (const struct sockaddr *)&pub->group, pub->group_len) < 0)
+    {
+        // Nobody depends on spectators, so a failed send is counted rather than ending the game
+        pub->errors++;
+        return;
+    }
+    pub->sent++;
+}
+
+// Finds the player a datagram came from, remembering new ones while there is room
+static spectate_source *find_source(spectate_view *view, const struct sockaddr_storage *from, int *index)
+{
+    for(int i = 0; i < view->count; i++)
+    {
+        if(peer_same_address(&view->sources[i].addr, from))
+        {
+            *index = i;
+            return &view->sources[i];
+        }
+    }
+    if(view->count == SPECTATE_SOURCES)
+    {
+        return NULL;
+    }
+    // The slot may still hold a player that spectate_view_expire() moved down
+    *index = view->count++;
+    memset(&view->sources[*index], 0, sizeof(view->sources[0]));
+    memcpy(&view->sources[*index].addr, from, sizeof(*from));
+    sync_init(&view->sources[*index].sync);
+    view->sources[*index].mark = free_mark(view, *index);
+    return &view->sources[*index];
+}
+
+// The lowest mark none of the first count sources holds. Marks follow the player rather than the
+// slot, so expiring someone further up does not change how everyone below is drawn.
+static int free_mark(const spectate_view *view, int count)
+{
+    unsigned taken = 0;
+
+    for(int i = 0; i < count; i++)
+    {
+        taken |= 1U << view->sources[i].mark;
+    }
+    for(int mark = 0; mark < SPECTATE_SOURCES; mark++)
+    {
+        if((taken & (1U << mark)) == 0)
+        {
+            return mark;
+        }
+    }
+    return 0;
+}
+
+static bool is_multicast(const struct sockaddr_storage *group)
+{
+    if(group->ss_family == AF_INET)
+    {
+        return IN_MULTICAST(ntohl(((const struct sockaddr_in *)group)->sin_addr.s_addr));
+    }
+    if(group->ss_family == AF_INET6)
+    {
+        return IN6_IS_ADDR_MULTICAST(&((const struct sockaddr_in6 *)group)->sin6_addr);
+    }
+    return false;
+}
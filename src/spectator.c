@@ -0,0 +1,281 @@
+#include "spectate.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <ncurses.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LINES 40
+#define COLS 40
+#define UNKNOWN_OPTION_MESSAGE_LEN 24
+#define MILLIS_PER_SEC 1000
+#define NANOS_PER_MILLI 1000000L
+
+static void                  parse_arguments(int argc, char *argv[], const char **group, in_port_t *port, const char **interface_ip);
+_Noreturn static void        usage(const char *program_name, int exit_code, const char *message);
+static in_port_t             parse_port(const char *program_name, const char *str);
+static int                   group_address(const char *address, in_port_t port, struct sockaddr_storage *addr, socklen_t *addr_len);
+static void                  sigint_handler(int signum);
+static void                  draw_view(WINDOW *win, const spectate_view *view, const char *group);
+static int64_t               monotonic_ms(void);
+static volatile sig_atomic_t exit_flag = 0;    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+
+// A read-only view of a match: joins the group the players publish to with -s/-S and draws whatever
+// they send. The players do no extra work however many of these are running.
+int main(int argc, char *argv[])
+{
+    const char             *group;
+    const char             *interface_ip;
+    in_port_t               port;
+    struct sockaddr_storage group_addr;
+    socklen_t               group_len;
+    struct sigaction        sa;
+    spectate_view           view;
+    WINDOW                 *win;
+    int                     sock;
+
+    parse_arguments(argc, argv, &group, &port, &interface_ip);
+    if(group_address(group, port, &group_addr, &group_len) != 0)
+    {
+        return EXIT_FAILURE;
+    }
+    sock = spectate_listen(&group_addr, group_len, interface_ip);
+    if(sock < 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+#if defined(__clang__)
+    #pragma clang diagnostic push
+    #pragma clang diagnostic ignored "-Wdisabled-macro-expansion"
+#endif
+    sa.sa_handler = sigint_handler;
+#if defined(__clang__)
+    #pragma clang diagnostic pop
+#endif
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    initscr();
+    raw();
+    noecho();
+    curs_set(0);
+    win = newwin(LINES, COLS, 1, 1);
+    refresh();
+    spectate_view_init(&view);
+    draw_view(win, &view, group);
+
+    while(!exit_flag)
+    {
+        struct pollfd fds[2];
+
+        fds[0].fd     = sock;
+        fds[0].events = POLLIN;
+        fds[1].fd     = STDIN_FILENO;
+        fds[1].events = POLLIN;
+        // Wake at least once per keyframe interval to forget players that have gone quiet
+        if(poll(fds, 2, SPECTATE_KEYFRAME_MS) < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            perror("poll");
+            break;
+        }
+
+        if(fds[1].revents & POLLIN)
+        {
+            char key;
+
+            // q or Ctrl+C, since raw() turns the latter into a plain character
+            if(read(STDIN_FILENO, &key, 1) <= 0 || key == 'q' || key == '\x03')
+            {
+                break;
+            }
+        }
+
+        if(fds[0].revents & POLLIN)
+        {
+            struct sockaddr_storage from;
+            socklen_t               from_len = sizeof(from);
+            uint8_t                 buf[SYNC_PACKET_MAX];
+            ssize_t                 bytes;
+
+            bytes = recvfrom(sock, buf, sizeof(buf), 0, (struct sockaddr *)&from, &from_len);
+            if(bytes >= 0 && spectate_view_receive(&view, &from, buf, (size_t)bytes, monotonic_ms()) >= 0)
+            {
+                draw_view(win, &view, group);
+            }
+        }
+
+        if(spectate_view_expire(&view, monotonic_ms()))
+        {
+            draw_view(win, &view, group);
+        }
+    }
+
+    endwin();
+    printf("Updates applied: %llu, waited for a keyframe: %llu, ignored: %llu\n", (unsigned long long)view.updates, (unsigned long long)view.missing_baseline, (unsigned long long)view.ignored);
+    close(sock);
+    return EXIT_SUCCESS;
+}
+
+static void parse_arguments(int argc, char *argv[], const char **group, in_port_t *port, const char **interface_ip)
+{
+    int opt;
+
+    *group        = NULL;
+    *port         = 0;
+    *interface_ip = NULL;
+    opterr        = 0;
+    while((opt = getopt(argc, argv, "hs:S:i:")) != -1)
+    {
+        switch(opt)
+        {
+            case 's':
+            {
+                *group = optarg;
+                break;
+            }
+            case 'S':
+            {
+                *port = parse_port(argv[0], optarg);
+                break;
+            }
+            case 'i':
+            {
+                *interface_ip = optarg;
+                break;
+            }
+            case 'h':
+            {
+                usage(argv[0], EXIT_SUCCESS, NULL);
+            }
+            case '?':
+            {
+                char message[UNKNOWN_OPTION_MESSAGE_LEN];
+
+                snprintf(message, sizeof(message), "Unknown option '-%c'.", optopt);
+                usage(argv[0], EXIT_FAILURE, message);
+            }
+            default:
+            {
+                usage(argv[0], EXIT_FAILURE, NULL);
+            }
+        }
+    }
+    if(*group == NULL || *port == 0)
+    {
+        usage(argv[0], EXIT_FAILURE, "The multicast group and port are required.");
+    }
+    if(optind < argc)
+    {
+        usage(argv[0], EXIT_FAILURE, "Too many arguments.");
+    }
+}
+
+_Noreturn static void usage(const char *program_name, int exit_code, const char *message)
+{
+    if(message)
+    {
+        fprintf(stderr, "%s\n", message);
+    }
+
+    fprintf(stderr, "Usage: %s -s <multicast group> -S <port> [-i <interface ip>] [-h]\n", program_name);
+    fputs("Options:\n", stderr);
+    fputs("  -h   Display this help message\n", stderr);
+    fputs("  -s   Multicast group the players publish to\n", stderr);
+    fputs("  -S   Port of the group\n", stderr);
+    fputs("  -i   IPv4 address of the interface to join on, e.g. 127.0.0.1\n", stderr);
+    fputs("Press q to stop watching.\n", stderr);
+    exit(exit_code);
+}
+
+static in_port_t parse_port(const char *program_name, const char *str)
+{
+    char *endptr;
+    long  val;
+
+    errno = 0;
+    val   = strtol(str, &endptr, 10);    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    if(endptr == str || *endptr != '\0' || errno != 0 || val <= 0 || val > UINT16_MAX)
+    {
+        usage(program_name, EXIT_FAILURE, "Invalid port.");
+    }
+    return (in_port_t)val;
+}
+
+static int group_address(const char *address, in_port_t port, struct sockaddr_storage *addr, socklen_t *addr_len)
+{
+    memset(addr, 0, sizeof(*addr));
+    if(inet_pton(AF_INET, address, &((struct sockaddr_in *)addr)->sin_addr) == 1)
+    {
+        addr->ss_family                       = AF_INET;
+        ((struct sockaddr_in *)addr)->sin_port = htons(port);
+        *addr_len                             = sizeof(struct sockaddr_in);
+        return 0;
+    }
+    if(inet_pton(AF_INET6, address, &((struct sockaddr_in6 *)addr)->sin6_addr) == 1)
+    {
+        addr->ss_family                         = AF_INET6;
+        ((struct sockaddr_in6 *)addr)->sin6_port = htons(port);
+        *addr_len                               = sizeof(struct sockaddr_in6);
+        return 0;
+    }
+    fprintf(stderr, "%s is not an IPv4 or an IPv6 address\n", address);
+    return -1;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+
+static void sigint_handler(int signum)
+{
+    exit_flag = 1;
+}
+
+#pragma GCC diagnostic pop
+
+// Each player is trusted for its own position and keeps its glyph for as long as it is heard from.
+// Until the second player is heard from, the first one's view of its opponent stands in, drawn with
+// the glyph the second player will get.
+static void draw_view(WINDOW *win, const spectate_view *view, const char *group)
+{
+    static const char glyphs[SPECTATE_SOURCES] = {'*', '@', '#', '%'};
+
+    wclear(win);
+    if(view->count == 1 && view->sources[0].has_state && view->sources[0].state_len >= 4)
+    {
+        mvwprintw(win, view->sources[0].state[3], view->sources[0].state[2], "%c", glyphs[view->sources[0].mark == 0 ? 1 : 0]);
+    }
+    for(int i = 0; i < view->count; i++)
+    {
+        const spectate_source *source = &view->sources[i];
+
+        if(source->has_state && source->state_len >= 2)
+        {
+            mvwprintw(win, source->state[1], source->state[0], "%c", glyphs[source->mark]);
+        }
+    }
+    box(win, 0, 0);
+    mvprintw(LINES + 1, 0, "Watching %s: %d player(s), %llu updates    ", group, view->count, (unsigned long long)view->updates);
+    refresh();
+    wrefresh(win);
+}
+
+static int64_t monotonic_ms(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * MILLIS_PER_SEC + now.tv_nsec / NANOS_PER_MILLI;
+}
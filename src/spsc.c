@@ -0,0 +1,185 @@
+#include "spsc.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define DRAIN_LEN 64
+
+// capacity is rounded up to a power of two so indices wrap with a mask
+int spsc_init(spsc_ring *ring, size_t record_size, size_t capacity)
+{
+    size_t slots = 1;
+
+    while(slots < capacity)
+    {
+        slots <<= 1;
+    }
+    memset(ring, 0, sizeof(*ring));
+    ring->records = (uint8_t *)calloc(slots, record_size);
+    if(ring->records == NULL)
+    {
+        perror("calloc");
+        return -1;
+    }
+    ring->record_size = record_size;
+    ring->mask        = slots - 1;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    return 0;
+}
+
+// Producer side. Returns false, without blocking, when the ring is full.
+bool spsc_push(spsc_ring *ring, const void *record)
+{
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+    if(tail - ring->cached_head > ring->mask)
+    {
+        ring->cached_head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if(tail - ring->cached_head > ring->mask)
+        {
+            return false;
+        }
+    }
+    memcpy(&ring->records[(tail & ring->mask) * ring->record_size], record, ring->record_size);
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+// Consumer side. Returns false when there is nothing to pop.
+bool spsc_pop(spsc_ring *ring, void *record)
+{
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+    if(head == ring->cached_tail)
+    {
+        ring->cached_tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        if(head == ring->cached_tail)
+        {
+            return false;
+        }
+    }
+    memcpy(record, &ring->records[(head & ring->mask) * ring->record_size], ring->record_size);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return true;
+}
+
+// Consumer side
+bool spsc_empty(spsc_ring *ring)
+{
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+    if(head != ring->cached_tail)
+    {
+        return false;
+    }
+    ring->cached_tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    return head == ring->cached_tail;
+}
+
+void spsc_destroy(spsc_ring *ring)
+{
+    free(ring->records);
+    ring->records = NULL;
+}
+
+int spsc_doorbell_init(spsc_doorbell *bell)
+{
+    if(pipe(bell->fds) < 0)
+    {
+        perror("pipe");
+        return -1;
+    }
+    // Neither side may ever block on the pipe itself: a full pipe already means "wake up"
+    fcntl(bell->fds[0], F_SETFL, fcntl(bell->fds[0], F_GETFL) | O_NONBLOCK);
+    fcntl(bell->fds[1], F_SETFL, fcntl(bell->fds[1], F_GETFL) | O_NONBLOCK);
+    atomic_init(&bell->sleeping, false);
+    return 0;
+}
+
+// Called by a producer after pushing. Free unless the consumer is asleep or about to be.
+void spsc_doorbell_ring(spsc_doorbell *bell)
+{
+    // Pairs with the fence in spsc_doorbell_arm. Release and acquire alone would let this side miss
+    // sleeping while the consumer misses the new tail, and the consumer would sleep through the push.
+    atomic_thread_fence(memory_order_seq_cst);
+    if(atomic_exchange(&bell->sleeping, false))
+    {
+        const char wake = 1;
+
+        if(write(bell->fds[1], &wake, 1) < 0)
+        {
+            // Full means a wake-up is already pending
+            return;
+        }
+    }
+}
+
+// Wakes the consumer now or on its next sleep, asleep or not; for shutting a thread down
+void spsc_doorbell_wake(spsc_doorbell *bell)
+{
+    const char wake = 1;
+
+    atomic_store(&bell->sleeping, false);
+    if(write(bell->fds[1], &wake, 1) < 0)
+    {
+        return;
+    }
+}
+
+// Called by the consumer before checking its rings one last time and sleeping on fds[0]
+void spsc_doorbell_arm(spsc_doorbell *bell)
+{
+    atomic_store(&bell->sleeping, true);
+    // Orders the store above before the consumer's acquire loads of the ring tails; see spsc_doorbell_ring
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+// Called by the consumer once it is awake again
+void spsc_doorbell_disarm(spsc_doorbell *bell)
+{
+    char drain[DRAIN_LEN];
+
+    atomic_store(&bell->sleeping, false);
+    while(read(bell->fds[0], drain, sizeof(drain)) > 0)
+    {
+    }
+}
+
+// Sleeps until a producer rings or timeout_ms passes, unless one of the rings already has records.
+// Returns 1 if woken or work was waiting, 0 on timeout, -1 on error.
+int spsc_doorbell_wait(spsc_doorbell *bell, spsc_ring *const rings[], int count, int timeout_ms)
+{
+    struct pollfd fd;
+    int           ret;
+
+    spsc_doorbell_arm(bell);
+    for(int i = 0; i < count; i++)
+    {
+        if(!spsc_empty(rings[i]))
+        {
+            spsc_doorbell_disarm(bell);
+            return 1;
+        }
+    }
+    fd.fd      = bell->fds[0];
+    fd.events  = POLLIN;
+    fd.revents = 0;
+    ret        = poll(&fd, 1, timeout_ms);
+    spsc_doorbell_disarm(bell);
+    return ret < 0 ? -1 : ret;
+}
+
+void spsc_doorbell_destroy(spsc_doorbell *bell)
+{
+    if(bell->fds[0] >= 0)
+    {
+        close(bell->fds[0]);
+        close(bell->fds[1]);
+    }
+    bell->fds[0] = -1;
+    bell->fds[1] = -1;
+}
@@ -0,0 +1,252 @@
+#include "state_export.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Other processes share these, so they must not fall back to a lock private to one process
+_Static_assert(ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_LONG_LOCK_FREE == 2 && ATOMIC_LLONG_LOCK_FREE == 2, "the segment's atomics must be lock-free");
+
+static int  segment_name(char *out, const char *name);
+static bool segment_in_use(const char *name, int32_t *pid);
+
+// Creates the segment and maps it read-write. Fails if a running game already publishes under the name.
+// A segment left by a crashed run is unlinked first, so readers still holding it keep their stale copy
+// rather than seeing this one half-built. name gets a leading '/' if it lacks one.
+int state_export_open(state_export *exp, const char *name)
+{
+    state_export_page *page;
+    void              *map;
+    int32_t            owner;
+    int                fd;
+
+    memset(exp, 0, sizeof(*exp));
+    if(segment_name(exp->name, name) != 0)
+    {
+        return -1;
+    }
+    if(segment_in_use(exp->name, &owner))
+    {
+        fprintf(stderr, "Shared memory %s is in use by process %d\n", exp->name, (int)owner);
+        return -1;
+    }
+    shm_unlink(exp->name);
+    fd = shm_open(exp->name, O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if(fd < 0)
+    {
+        perror("shm_open");
+        return -1;
+    }
+    if(ftruncate(fd, sizeof(state_export_page)) != 0)
+    {
+        perror("ftruncate");
+        close(fd);
+        shm_unlink(exp->name);
+        return -1;
+    }
+    map = mmap(NULL, sizeof(state_export_page), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+    {
+        perror("mmap");
+        shm_unlink(exp->name);
+        return -1;
+    }
+
+    // ftruncate zero-filled it, so seq and every field already start at 0
+    page              = (state_export_page *)map;
+    page->version     = STATE_EXPORT_VERSION;
+    page->field_count = STATE_FIELDS;
+    page->pid         = (int32_t)getpid();
+    atomic_store_explicit(&page->magic, STATE_EXPORT_MAGIC, memory_order_release);
+    exp->page  = page;
+    exp->owner = true;
+    return 0;
+}
+
+// Publishes fields if any differ from the last publish, stamping STATE_FIELD_UPDATED_US with now_us.
+// A handful of plain stores and no system call; a reader that races with it retries, the writer never waits.
+void state_export_publish(state_export *exp, const int64_t *fields, int64_t now_us)
+{
+    state_export_page *page = exp->page;
+    uint64_t           seq;
+    bool               changed = false;
+
+    if(page == NULL)
+    {
+        return;
+    }
+    for(int f = 0; f < STATE_FIELDS; f++)
+    {
+        if(f != STATE_FIELD_UPDATED_US && fields[f] != exp->last[f])
+        {
+            changed = true;
+        }
+    }
+    if(!changed)
+    {
+        return;
+    }
+    memcpy(exp->last, fields, sizeof(exp->last));
+    exp->last[STATE_FIELD_UPDATED_US] = now_us;
+
+    seq = atomic_load_explicit(&page->seq, memory_order_relaxed);
+    atomic_store_explicit(&page->seq, seq + 1, memory_order_relaxed);
+    // Keeps the field stores from being seen before seq turns odd
+    atomic_thread_fence(memory_order_release);
+    for(int f = 0; f < STATE_FIELDS; f++)
+    {
+        atomic_store_explicit(&page->fields[f], exp->last[f], memory_order_relaxed);
+    }
+    atomic_store_explicit(&page->seq, seq + 2, memory_order_release);
+}
+
+// Maps a game's segment read-only, for tools. Fails if it is not there yet or has another layout.
+int state_export_attach(state_export *exp, const char *name)
+{
+    struct stat        st;
+    state_export_page *page;
+    void              *map;
+    int                fd;
+
+    memset(exp, 0, sizeof(*exp));
+    if(segment_name(exp->name, name) != 0)
+    {
+        return -1;
+    }
+    fd = shm_open(exp->name, O_RDONLY, 0);
+    if(fd < 0)
+    {
+        perror("shm_open");
+        return -1;
+    }
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(state_export_page))
+    {
+        fprintf(stderr, "%s is not a game state segment\n", exp->name);
+        close(fd);
+        return -1;
+    }
+    map = mmap(NULL, sizeof(state_export_page), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+    {
+        perror("mmap");
+        return -1;
+    }
+    page = (state_export_page *)map;
+    if(atomic_load_explicit(&page->magic, memory_order_acquire) != STATE_EXPORT_MAGIC || page->version != STATE_EXPORT_VERSION)
+    {
+        fprintf(stderr, "%s is not ready, or has a different layout\n", exp->name);
+        munmap(map, sizeof(state_export_page));
+        return -1;
+    }
+    exp->page = page;
+    return 0;
+}
+
+// Copies a consistent snapshot. Returns false if the game has closed the segment, or if it was
+// mid-update on every one of STATE_EXPORT_READ_TRIES attempts.
+bool state_export_read(const state_export *exp, state_snapshot *snap)
+{
+    state_export_page *page = exp->page;
+
+    if(!state_export_live(exp))
+    {
+        return false;
+    }
+    for(int tries = 0; tries < STATE_EXPORT_READ_TRIES; tries++)
+    {
+        uint64_t before = atomic_load_explicit(&page->seq, memory_order_acquire);
+
+        if(before & 1)
+        {
+            continue;
+        }
+        for(int f = 0; f < STATE_FIELDS; f++)
+        {
+            snap->fields[f] = atomic_load_explicit(&page->fields[f], memory_order_relaxed);
+        }
+        // Keeps the field loads from being moved after the second look at seq
+        atomic_thread_fence(memory_order_acquire);
+        if(atomic_load_explicit(&page->seq, memory_order_relaxed) == before)
+        {
+            snap->seq = before;
+            snap->pid = page->pid;
+            return true;
+        }
+    }
+    return false;
+}
+
+// False once the game has closed the segment
+bool state_export_live(const state_export *exp)
+{
+    return exp->page != NULL && atomic_load_explicit(&exp->page->magic, memory_order_acquire) == STATE_EXPORT_MAGIC;
+}
+
+// Unmaps the segment. The game also marks it closed and unlinks it, so tools see it go away.
+void state_export_close(state_export *exp)
+{
+    if(exp->page == NULL)
+    {
+        return;
+    }
+    if(exp->owner)
+    {
+        atomic_store_explicit(&exp->page->magic, 0, memory_order_release);
+        shm_unlink(exp->name);
+    }
+    munmap(exp->page, sizeof(state_export_page));
+    exp->page = NULL;
+}
+
+// POSIX wants exactly one slash, at the front
+static int segment_name(char *out, const char *name)
+{
+    int len;
+
+    len = snprintf(out, STATE_EXPORT_NAME_MAX, "%s%s", name[0] == '/' ? "" : "/", name);
+    if(len < 2 || len >= STATE_EXPORT_NAME_MAX || strchr(out + 1, '/') != NULL)
+    {
+        fprintf(stderr, "Invalid shared memory name: %s\n", name);
+        return -1;
+    }
+    return 0;
+}
+
+// True if name holds a live segment whose writer is still running. EPERM from kill still means the
+// process exists; it just belongs to someone else. Quiet when there is nothing there, the usual case.
+static bool segment_in_use(const char *name, int32_t *pid)
+{
+    struct stat              st;
+    const state_export_page *page;
+    void                    *map;
+    bool                     in_use;
+    int                      fd;
+
+    fd = shm_open(name, O_RDONLY, 0);
+    if(fd < 0)
+    {
+        return false;
+    }
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(state_export_page))
+    {
+        close(fd);
+        return false;
+    }
+    map = mmap(NULL, sizeof(state_export_page), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+    {
+        return false;
+    }
+    page   = (const state_export_page *)map;
+    *pid   = page->pid;
+    in_use = atomic_load_explicit(&page->magic, memory_order_acquire) == STATE_EXPORT_MAGIC && (kill((pid_t)*pid, 0) == 0 || errno == EPERM);
+    munmap(map, sizeof(state_export_page));
+    return in_use;
+}
@@ -0,0 +1,223 @@
+#include "state_export.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_INTERVAL_MS 100
+#define UNKNOWN_OPTION_MESSAGE_LEN 24
+#define MILLIS_PER_SEC 1000
+#define MICROS_PER_MILLI 1000
+#define MICROS_PER_SEC 1000000L
+#define NANOS_PER_MICRO 1000L
+#define NANOS_PER_MILLI 1000000L
+
+static void                  parse_arguments(int argc, char *argv[], const char **name, long *interval_ms, long *count);
+_Noreturn static void        usage(const char *program_name, int exit_code, const char *message);
+static long                  parse_number(const char *program_name, const char *str, long min);
+static void                  sigint_handler(int signum);
+static void                  print_snapshot(const state_snapshot *snap);
+static int64_t               monotonic_us(void);
+static volatile sig_atomic_t exit_flag = 0;    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+
+// Maps a game's state segment (its -e name) read-only and prints a line whenever the state changes.
+// Each look is a few loads from shared memory, so polling costs the game nothing however fast it is.
+int main(int argc, char *argv[])
+{
+    const char      *name;
+    long             interval_ms;
+    long             count;
+    long             printed = 0;
+    uint64_t         reads   = 0;
+    uint64_t         torn    = 0;
+    uint64_t         last_seq;
+    bool             has_last = false;
+    struct sigaction sa;
+    struct timespec  pause;
+    state_export     exp;
+    state_snapshot   snap;
+
+    parse_arguments(argc, argv, &name, &interval_ms, &count);
+    if(state_export_attach(&exp, name) != 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+#if defined(__clang__)
+    #pragma clang diagnostic push
+    #pragma clang diagnostic ignored "-Wdisabled-macro-expansion"
+#endif
+    sa.sa_handler = sigint_handler;
+#if defined(__clang__)
+    #pragma clang diagnostic pop
+#endif
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    pause.tv_sec  = interval_ms / MILLIS_PER_SEC;
+    pause.tv_nsec = (interval_ms % MILLIS_PER_SEC) * NANOS_PER_MILLI;
+    last_seq      = 0;
+    while(!exit_flag && (count == 0 || printed < count))
+    {
+        reads++;
+        if(state_export_read(&exp, &snap))
+        {
+            if(!has_last || snap.seq != last_seq)
+            {
+                print_snapshot(&snap);
+                printed++;
+                last_seq = snap.seq;
+                has_last = true;
+            }
+        }
+        else if(!state_export_live(&exp))
+        {
+            printf("The game closed %s\n", exp.name);
+            break;
+        }
+        else
+        {
+            // The writer was mid-update on every try; the next poll will catch it between updates
+            torn++;
+        }
+        if(interval_ms > 0 && nanosleep(&pause, NULL) != 0 && errno != EINTR)
+        {
+            perror("nanosleep");
+            break;
+        }
+    }
+
+    printf("Polls: %llu, changes shown: %ld, polls that only caught an update in progress: %llu\n", (unsigned long long)reads, printed, (unsigned long long)torn);
+    state_export_close(&exp);
+    return EXIT_SUCCESS;
+}
+
+static void parse_arguments(int argc, char *argv[], const char **name, long *interval_ms, long *count)
+{
+    int opt;
+
+    *name        = NULL;
+    *interval_ms = DEFAULT_INTERVAL_MS;
+    *count       = 0;
+    opterr       = 0;
+    while((opt = getopt(argc, argv, "hn:i:c:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'n':
+            {
+                *name = optarg;
+                break;
+            }
+            case 'i':
+            {
+                *interval_ms = parse_number(argv[0], optarg, 0);
+                break;
+            }
+            case 'c':
+            {
+                *count = parse_number(argv[0], optarg, 1);
+                break;
+            }
+            case 'h':
+            {
+                usage(argv[0], EXIT_SUCCESS, NULL);
+            }
+            case '?':
+            {
+                char message[UNKNOWN_OPTION_MESSAGE_LEN];
+
+                snprintf(message, sizeof(message), "Unknown option '-%c'.", optopt);
+                usage(argv[0], EXIT_FAILURE, message);
+            }
+            default:
+            {
+                usage(argv[0], EXIT_FAILURE, NULL);
+            }
+        }
+    }
+    if(*name == NULL)
+    {
+        usage(argv[0], EXIT_FAILURE, "The segment name is required.");
+    }
+    if(optind < argc)
+    {
+        usage(argv[0], EXIT_FAILURE, "Too many arguments.");
+    }
+}
+
+_Noreturn static void usage(const char *program_name, int exit_code, const char *message)
+{
+    if(message)
+    {
+        fprintf(stderr, "%s\n", message);
+    }
+
+    fprintf(stderr, "Usage: %s -n <segment name> [-i <poll interval ms>] [-c <changes>] [-h]\n", program_name);
+    fputs("Options:\n", stderr);
+    fputs("  -h   Display this help message\n", stderr);
+    fputs("  -n   Shared memory name the game publishes to with -e\n", stderr);
+    fputs("  -i   Milliseconds between polls, 0 to spin (default 100)\n", stderr);
+    fputs("  -c   Stop after showing this many changes\n", stderr);
+    exit(exit_code);
+}
+
+static long parse_number(const char *program_name, const char *str, long min)
+{
+    char *endptr;
+    long  val;
+
+    errno = 0;
+    val   = strtol(str, &endptr, 10);    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    if(endptr == str || *endptr != '\0' || errno != 0 || val < min)
+    {
+        usage(program_name, EXIT_FAILURE, "Invalid number.");
+    }
+    return val;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+
+static void sigint_handler(int signum)
+{
+    exit_flag = 1;
+}
+
+#pragma GCC diagnostic pop
+
+// The age is how long ago the game last changed anything, by the same monotonic clock
+static void print_snapshot(const state_snapshot *snap)
+{
+    const int64_t *f = snap->fields;
+
+    printf("pid %d update %llu: local (%lld,%lld) remote (%lld,%lld) sent %lld received %lld invalid %lld timer %lld moves %lld combined %lld frame %lld rollbacks %lld, %.1f ms ago\n",
+           (int)snap->pid,
+           (unsigned long long)(snap->seq / 2),
+           (long long)f[STATE_FIELD_LOCAL_X],
+           (long long)f[STATE_FIELD_LOCAL_Y],
+           (long long)f[STATE_FIELD_REMOTE_X],
+           (long long)f[STATE_FIELD_REMOTE_Y],
+           (long long)f[STATE_FIELD_PACKETS_SENT],
+           (long long)f[STATE_FIELD_PACKETS_RECEIVED],
+           (long long)f[STATE_FIELD_INVALID_MOVES],
+           (long long)f[STATE_FIELD_TIMER_MOVES],
+           (long long)f[STATE_FIELD_MOVES_SENT],
+           (long long)f[STATE_FIELD_MOVES_COALESCED],
+           (long long)f[STATE_FIELD_ROLLBACK_FRAME],
+           (long long)f[STATE_FIELD_ROLLBACKS],
+           (double)(monotonic_us() - f[STATE_FIELD_UPDATED_US]) / MICROS_PER_MILLI);
+    fflush(stdout);
+}
+
+static int64_t monotonic_us(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * MICROS_PER_SEC + now.tv_nsec / NANOS_PER_MICRO;
+}
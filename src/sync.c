@@ -0,0 +1,286 @@
+#include "sync.h"
+#include <string.h>
+
+static bool        seq_newer(uint16_t a, uint16_t b);
+static void        put_u16(uint8_t *out, uint16_t value);
+static uint16_t    get_u16(const uint8_t *in);
+static void        record_frame(sync_frame *history, uint16_t seq, const uint8_t *state, size_t len);
+
+// Resets all sequence numbers and history
+void sync_init(sync_state *sync)
+{
+    memset(sync, 0, sizeof(*sync));
+}
+
+// A join asks the peer for a full snapshot; it carries no payload
+size_t sync_encode_join(uint8_t *out, size_t cap)
+{
+    if(cap < 1)
+    {
+        return 0;
+    }
+    out[0] = SYNC_MSG_JOIN;
+    return 1;
+}
+
+// Acknowledges a snapshot or delta so the peer can use it as the next baseline
+size_t sync_encode_ack(uint16_t seq, uint8_t *out, size_t cap)
+{
+    if(cap < 3)
+    {
+        return 0;
+    }
+    out[0] = SYNC_MSG_ACK;
+    put_u16(&out[1], seq);
+    return 3;
+}
+
+// Layout: tag, seq, state length, state bytes
+size_t sync_encode_snapshot(sync_state *sync, const uint8_t *state, size_t len, uint8_t *out, size_t cap)
+{
+    uint16_t seq;
+
+    if(len > SYNC_STATE_MAX || cap < SYNC_HEADER_LEN + len)
+    {
+        return 0;
+    }
+    seq = sync->next_seq++;
+    record_frame(sync->sent, seq, state, len);
+    out[0] = SYNC_MSG_SNAPSHOT;
+    put_u16(&out[1], seq);
+    put_u16(&out[3], (uint16_t)len);
+    memcpy(&out[SYNC_HEADER_LEN], state, len);
+    return SYNC_HEADER_LEN + len;
+}
+
+// A snapshot that becomes the baseline for the deltas after it straight away, for receivers that
+// never acknowledge anything, such as multicast spectators
+size_t sync_encode_keyframe(sync_state *sync, const uint8_t *state, size_t len, uint8_t *out, size_t cap)
+{
+    uint16_t seq = sync->next_seq;
+    size_t   n;
+
+    n = sync_encode_snapshot(sync, state, len, out, cap);
+    if(n > 0)
+    {
+        sync->acked_seq = seq;
+        sync->has_ack   = true;
+    }
+    return n;
+}
+
+// Sends a delta against the last acknowledged frame, or a snapshot if there is no usable baseline.
+// Delta layout: tag, seq, baseline seq, one bit per state byte that changed, the changed bytes.
+size_t sync_encode_update(sync_state *sync, const uint8_t *state, size_t len, uint8_t *out, size_t cap)
+{
+    const sync_frame *base;
+    size_t            mask_len;
+    size_t            pos;
+    uint16_t          seq;
+    uint16_t          base_seq;
+
+    if(!sync->has_ack)
+    {
+        return sync_encode_snapshot(sync, state, len, out, cap);
+    }
+    base = &sync->sent[sync->acked_seq % SYNC_HISTORY];
+    if(!base->valid || base->seq != sync->acked_seq || base->len != len)
+    {
+        return sync_encode_snapshot(sync, state, len, out, cap);
+    }
+
+    base_seq = base->seq;
+    mask_len = (len + 7) / 8;
+    if(cap < SYNC_HEADER_LEN + mask_len + len)
+    {
+        return 0;
+    }
+    memset(&out[SYNC_HEADER_LEN], 0, mask_len);
+    pos = SYNC_HEADER_LEN + mask_len;
+    for(size_t i = 0; i < len; i++)
+    {
+        if(state[i] != base->bytes[i])
+        {
+            out[SYNC_HEADER_LEN + i / 8] |= (uint8_t)(1U << (i % 8));
+            out[pos++] = state[i];
+        }
+    }
+
+    // Recording may reuse the baseline's slot once the peer falls SYNC_HISTORY frames behind
+    seq = sync->next_seq++;
+    record_frame(sync->sent, seq, state, len);
+    out[0] = SYNC_MSG_DELTA;
+    put_u16(&out[1], seq);
+    put_u16(&out[3], base_seq);
+    return pos;
+}
+
+// Cheap shape check on the tag and length only, so junk can be dropped before any decoding
+bool sync_plausible(const uint8_t *in, size_t in_len)
+{
+    if(in_len < 1 || in_len > SYNC_PACKET_MAX)
+    {
+        return false;
+    }
+    switch(in[0])
+    {
+        case SYNC_MSG_JOIN:
+            return in_len == 1;
+        case SYNC_MSG_ACK:
+            return in_len == 3;
+        case SYNC_MSG_SNAPSHOT:
+        case SYNC_MSG_DELTA:
+            return in_len >= SYNC_HEADER_LEN;
+        default:
+            return false;
+    }
+}
+
+// Returns the message type, -1 for malformed or stale datagrams that can be ignored,
+// or SYNC_MISSING_BASELINE for a delta against a frame we never saw, which needs a fresh snapshot
+int sync_decode(sync_state *sync, const uint8_t *in, size_t in_len, sync_message *msg)
+{
+    memset(msg, 0, sizeof(*msg));
+    if(in_len < 1)
+    {
+        return -1;
+    }
+    msg->type = in[0];
+
+    switch(msg->type)
+    {
+        case SYNC_MSG_JOIN:
+        {
+            // The peer (re)started, so whatever it acknowledged or sent before is gone
+            sync->has_ack      = false;
+            sync->has_received = false;
+            memset(sync->received, 0, sizeof(sync->received));
+            return SYNC_MSG_JOIN;
+        }
+        case SYNC_MSG_ACK:
+        {
+            const sync_frame *frame;
+
+            if(in_len != 3)
+            {
+                return -1;
+            }
+            msg->seq = get_u16(&in[1]);
+            frame    = &sync->sent[msg->seq % SYNC_HISTORY];
+            if(frame->valid && frame->seq == msg->seq && (!sync->has_ack || seq_newer(msg->seq, sync->acked_seq)))
+            {
+                sync->acked_seq = msg->seq;
+                sync->has_ack   = true;
+            }
+            return SYNC_MSG_ACK;
+        }
+        case SYNC_MSG_SNAPSHOT:
+        {
+            if(in_len < SYNC_HEADER_LEN)
+            {
+                return -1;
+            }
+            msg->seq = get_u16(&in[1]);
+            msg->len = get_u16(&in[3]);
+            if(msg->len > SYNC_STATE_MAX || in_len != SYNC_HEADER_LEN + (size_t)msg->len)
+            {
+                return -1;
+            }
+            if(sync->has_received && !seq_newer(msg->seq, sync->last_received_seq))
+            {
+                return -1;
+            }
+            // Older frames stay in the history, since deltas still in flight may be based on them
+            memcpy(msg->state, &in[SYNC_HEADER_LEN], msg->len);
+            record_frame(sync->received, msg->seq, msg->state, msg->len);
+            sync->last_received_seq = msg->seq;
+            sync->has_received      = true;
+            return SYNC_MSG_SNAPSHOT;
+        }
+        case SYNC_MSG_DELTA:
+        {
+            const sync_frame *base;
+            uint16_t          base_seq;
+            size_t            mask_len;
+            size_t            pos;
+
+            if(in_len < SYNC_HEADER_LEN)
+            {
+                return -1;
+            }
+            if(!sync->has_received)
+            {
+                return SYNC_MISSING_BASELINE;
+            }
+            msg->seq = get_u16(&in[1]);
+            base_seq = get_u16(&in[3]);
+            if(!seq_newer(msg->seq, sync->last_received_seq))
+            {
+                return -1;
+            }
+            base = &sync->received[base_seq % SYNC_HISTORY];
+            if(!base->valid || base->seq != base_seq)
+            {
+                return SYNC_MISSING_BASELINE;
+            }
+            msg->len = base->len;
+            mask_len = ((size_t)msg->len + 7) / 8;
+            if(in_len < SYNC_HEADER_LEN + mask_len)
+            {
+                return -1;
+            }
+            memcpy(msg->state, base->bytes, msg->len);
+            pos = SYNC_HEADER_LEN + mask_len;
+            for(size_t i = 0; i < msg->len; i++)
+            {
+                if(in[SYNC_HEADER_LEN + i / 8] & (1U << (i % 8)))
+                {
+                    if(pos >= in_len)
+                    {
+                        return -1;
+                    }
+                    msg->state[i] = in[pos++];
+                }
+            }
+            if(pos != in_len)
+            {
+                return -1;
+            }
+            record_frame(sync->received, msg->seq, msg->state, msg->len);
+            sync->last_received_seq = msg->seq;
+            return SYNC_MSG_DELTA;
+        }
+        default:
+        {
+            return -1;
+        }
+    }
+}
+
+// Serial number comparison so sequences survive wrapping past UINT16_MAX
+static bool seq_newer(uint16_t a, uint16_t b)
+{
+    return (int16_t)(uint16_t)(a - b) > 0;
+}
+
+static void put_u16(uint8_t *out, uint16_t value)
+{
+    out[0] = (uint8_t)(value >> 8);
+    out[1] = (uint8_t)(value & 0xFF);    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+}
+
+static uint16_t get_u16(const uint8_t *in)
+{
+    return (uint16_t)((in[0] << 8) | in[1]);
+}
+
+static void record_frame(sync_frame *history, uint16_t seq, const uint8_t *state, size_t len)
+{
+    sync_frame *frame;
+
+    frame        = &history[seq % SYNC_HISTORY];
+    frame->seq   = seq;
+    frame->len   = (uint16_t)len;
+    frame->valid = true;
+    memcpy(frame->bytes, state, len);
+}
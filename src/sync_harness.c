@@ -0,0 +1,461 @@
+#include "sync.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define COLS 40
+#define DEFAULT_SECONDS 5
+#define DEFAULT_RATE 60
+#define SEQ_SPACE 65536
+#define RTT_BUCKETS 2000
+#define LAG_BUCKETS 1000
+#define NANOS_PER_SEC 1000000000LL
+#define NANOS_PER_MILLI 1000000LL
+#define P50 0.50
+#define P99 0.99
+#define UNKNOWN_OPTION_MESSAGE_LEN 24
+
+// The moving player: sends its position the same way move_local() does
+typedef struct
+{
+    int        sock;
+    sync_state sync;
+    int        x;
+    int        y;
+    int        dx;
+    int        dy;
+    uint64_t   bytes_sent;
+    uint64_t   resyncs;
+} player_side;
+
+// The watching player: applies and acknowledges updates the same way apply_sync() does
+typedef struct
+{
+    int        sock;
+    sync_state sync;
+    bool       has_view;
+    uint16_t   view_seq;    // the update the view came from
+    uint64_t   applied;
+    uint64_t   rejected;
+    uint64_t   bytes_sent;
+} observer_side;
+
+static void             parse_arguments(int argc, char *argv[], const char **ip, in_port_t ports[4], int *seconds, int *rate, const char **label);
+_Noreturn static void   usage(const char *program_name, int exit_code, const char *message);
+static in_port_t        parse_port(const char *program_name, const char *str);
+static int              parse_positive(const char *program_name, const char *str);
+static int              open_socket(const char *ip, in_port_t port);
+static int              send_to(int sock, const char *ip, in_port_t port, const uint8_t *buf, size_t len);
+static int64_t          now_ns(void);
+static void             step_player(player_side *player);
+static void             player_receive(player_side *player, int64_t now, const int64_t *sent, uint32_t *histogram, uint64_t *samples);
+static void             observer_receive(observer_side *observer, const char *ip, in_port_t port);
+static double           percentile(const uint32_t *histogram, int buckets, uint64_t samples, double fraction);
+
+static int64_t  sent_at[SEQ_SPACE];            // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+static int64_t  sent_tick[SEQ_SPACE];          // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+static uint32_t rtt_histogram[RTT_BUCKETS];    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+static uint32_t lag_histogram[LAG_BUCKETS];    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+
+// Drives the real snapshot/delta protocol between two sockets through the impairment proxy and reports how
+// latency, staleness and throughput hold up. Player A listens on -A and sends to -a; observer B listens on -B and sends to -b.
+int main(int argc, char *argv[])
+{
+    const char   *ip;
+    const char   *label;
+    in_port_t     ports[4];
+    int           seconds;
+    int           rate;
+    player_side   player;
+    observer_side observer;
+    int64_t       start;
+    int64_t       end;
+    int64_t       next_tick;
+    int64_t       interval;
+    int64_t       tick        = 0;
+    int64_t       max_lag     = 0;
+    uint64_t      lag_samples = 0;
+    uint64_t      rtt_samples = 0;
+    double        elapsed;
+
+    parse_arguments(argc, argv, &ip, ports, &seconds, &rate, &label);
+    memset(&player, 0, sizeof(player));
+    memset(&observer, 0, sizeof(observer));
+    player.sock   = open_socket(ip, ports[2]);
+    observer.sock = open_socket(ip, ports[3]);
+    if(player.sock < 0 || observer.sock < 0)
+    {
+        return EXIT_FAILURE;
+    }
+    sync_init(&player.sync);
+    sync_init(&observer.sync);
+    player.x  = 1;
+    player.y  = 1;
+    player.dx = 1;
+    player.dy = 1;
+
+    interval  = NANOS_PER_SEC / rate;
+    start     = now_ns();
+    end       = start + (int64_t)seconds * NANOS_PER_SEC;
+    next_tick = start;
+
+    while(now_ns() < end)
+    {
+        struct pollfd fds[2];
+        int64_t       now = now_ns();
+        int           timeout;
+
+        if(now >= next_tick)
+        {
+            uint8_t state[SYNC_STATE_MAX];
+            uint8_t packet[SYNC_PACKET_MAX];
+            size_t  len;
+
+            // How many ticks older the observer's view is than the newest position sent. The player moves
+            // every tick, so comparing positions would call any delay of a tick or more a desync; the age
+            // of the view is what actually grows as the network gets worse. Sampled before moving, so
+            // an update that arrived within one tick counts as 0.
+            if(observer.has_view)
+            {
+                int64_t lag = tick - 1 - sent_tick[observer.view_seq];
+
+                lag_histogram[lag < LAG_BUCKETS ? lag : LAG_BUCKETS - 1]++;
+                lag_samples++;
+                max_lag = lag > max_lag ? lag : max_lag;
+            }
+
+            step_player(&player);
+            state[0] = (uint8_t)player.x;
+            state[1] = (uint8_t)player.y;
+            state[2] = 1;
+            state[3] = 1;
+            sent_at[player.sync.next_seq]   = now;
+            sent_tick[player.sync.next_seq] = tick++;
+            len                             = sync_encode_update(&player.sync, state, 4, packet, sizeof(packet));
+            if(send_to(player.sock, ip, ports[0], packet, len) == 0)
+            {
+                player.bytes_sent += len;
+            }
+            next_tick += interval;
+        }
+
+        fds[0].fd     = player.sock;
+        fds[0].events = POLLIN;
+        fds[1].fd     = observer.sock;
+        fds[1].events = POLLIN;
+        timeout       = (int)((next_tick - now_ns()) / NANOS_PER_MILLI);
+        if(poll(fds, 2, timeout > 0 ? timeout : 0) < 0 && errno != EINTR)
+        {
+            perror("poll");
+            return EXIT_FAILURE;
+        }
+        if(fds[0].revents & POLLIN)
+        {
+            player_receive(&player, now_ns(), sent_at, rtt_histogram, &rtt_samples);
+        }
+        if(fds[1].revents & POLLIN)
+        {
+            observer_receive(&observer, ip, ports[1]);
+        }
+    }
+
+    elapsed = (double)(now_ns() - start) / (double)NANOS_PER_SEC;
+    printf("%-24s %10.1f %10.1f %10.1f %10.1f %10lld %10.1f %12.0f %8llu\n",
+           label,
+           percentile(rtt_histogram, RTT_BUCKETS, rtt_samples, P50),
+           percentile(rtt_histogram, RTT_BUCKETS, rtt_samples, P99),
+           percentile(lag_histogram, LAG_BUCKETS, lag_samples, P50),
+           percentile(lag_histogram, LAG_BUCKETS, lag_samples, P99),
+           (long long)max_lag,
+           (double)observer.applied / elapsed,
+           (double)(player.bytes_sent + observer.bytes_sent) / elapsed,
+           (unsigned long long)player.resyncs);
+
+    close(player.sock);
+    close(observer.sock);
+    return EXIT_SUCCESS;
+}
+
+static void parse_arguments(int argc, char *argv[], const char **ip, in_port_t ports[4], int *seconds, int *rate, const char **label)
+{
+    int opt;
+
+    *ip = NULL;
+    memset(ports, 0, 4 * sizeof(in_port_t));
+    *seconds = DEFAULT_SECONDS;
+    *rate    = DEFAULT_RATE;
+    *label   = "run";
+    opterr   = 0;
+    while((opt = getopt(argc, argv, "hi:a:b:A:B:t:r:n:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'i':
+            {
+                *ip = optarg;
+                break;
+            }
+            case 'a':
+            {
+                ports[0] = parse_port(argv[0], optarg);
+                break;
+            }
+            case 'b':
+            {
+                ports[1] = parse_port(argv[0], optarg);
+                break;
+            }
+            case 'A':
+            {
+                ports[2] = parse_port(argv[0], optarg);
+                break;
+            }
+            case 'B':
+            {
+                ports[3] = parse_port(argv[0], optarg);
+                break;
+            }
+            case 't':
+            {
+                *seconds = parse_positive(argv[0], optarg);
+                break;
+            }
+            case 'r':
+            {
+                *rate = parse_positive(argv[0], optarg);
+                break;
+            }
+            case 'n':
+            {
+                *label = optarg;
+                break;
+            }
+            case 'h':
+            {
+                usage(argv[0], EXIT_SUCCESS, NULL);
+            }
+            case '?':
+            {
+                char message[UNKNOWN_OPTION_MESSAGE_LEN];
+
+                snprintf(message, sizeof(message), "Unknown option '-%c'.", optopt);
+                usage(argv[0], EXIT_FAILURE, message);
+            }
+            default:
+            {
+                usage(argv[0], EXIT_FAILURE, NULL);
+            }
+        }
+    }
+    if(*ip == NULL || ports[0] == 0 || ports[1] == 0 || ports[2] == 0 || ports[3] == 0)
+    {
+        usage(argv[0], EXIT_FAILURE, "The IP and all four ports are required.");
+    }
+}
+
+_Noreturn static void usage(const char *program_name, int exit_code, const char *message)
+{
+    if(message)
+    {
+        fprintf(stderr, "%s\n", message);
+    }
+
+    fprintf(stderr, "Usage: %s -i <ip> -a <proxy port for A> -b <proxy port for B> -A <A's port> -B <B's port> [-t seconds] [-r moves per second] [-n label] [-h]\n", program_name);
+    fputs("Prints: label, RTT p50 and p99 (ms), ticks the observer's view lags the player at p50, p99 and max, updates applied/s, bytes/s, resyncs\n", stderr);
+    exit(exit_code);
+}
+
+static in_port_t parse_port(const char *program_name, const char *str)
+{
+    int val = parse_positive(program_name, str);
+
+    if(val > UINT16_MAX)
+    {
+        usage(program_name, EXIT_FAILURE, "Invalid port.");
+    }
+    return (in_port_t)val;
+}
+
+static int parse_positive(const char *program_name, const char *str)
+{
+    char *endptr;
+    long  val;
+
+    errno = 0;
+    val   = strtol(str, &endptr, 10);    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    if(endptr == str || *endptr != '\0' || errno != 0 || val <= 0 || val > INT32_MAX)
+    {
+        usage(program_name, EXIT_FAILURE, "Expected a positive number.");
+    }
+    return (int)val;
+}
+
+static int open_socket(const char *ip, in_port_t port)
+{
+    struct sockaddr_in addr;
+    int                sock;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port   = htons(port);
+    if(inet_pton(AF_INET, ip, &addr.sin_addr) != 1)
+    {
+        fprintf(stderr, "%s is not an IPv4 address\n", ip);
+        return -1;
+    }
+    sock = socket(AF_INET, SOCK_DGRAM, 0);    // NOLINT(android-cloexec-socket)
+    if(sock < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+    if(bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror("bind");
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+static int send_to(int sock, const char *ip, in_port_t port, const uint8_t *buf, size_t len)
+{
+    struct sockaddr_in addr;
+
+    if(len == 0)
+    {
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port   = htons(port);
+    inet_pton(AF_INET, ip, &addr.sin_addr);
+    return sendto(sock, buf, len, 0, (struct sockaddr *)&addr, sizeof(addr)) < 0 ? -1 : 0;
+}
+
+static int64_t now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * NANOS_PER_SEC + now.tv_nsec;
+}
+
+// Bounces diagonally around the board so every tick changes the state
+static void step_player(player_side *player)
+{
+    if(player->x + player->dx < 1 || player->x + player->dx >= COLS - 1)
+    {
+        player->dx = -player->dx;
+    }
+    if(player->y + player->dy < 1 || player->y + player->dy >= COLS - 1)
+    {
+        player->dy = -player->dy;
+    }
+    player->x += player->dx;
+    player->y += player->dy;
+}
+
+static void player_receive(player_side *player, int64_t now, const int64_t *sent, uint32_t *histogram, uint64_t *samples)
+{
+    uint8_t      packet[SYNC_PACKET_MAX];
+    sync_message msg;
+    ssize_t      bytes;
+
+    bytes = recv(player->sock, packet, sizeof(packet), 0);
+    if(bytes < 0)
+    {
+        return;
+    }
+    switch(sync_decode(&player->sync, packet, (size_t)bytes, &msg))
+    {
+        case SYNC_MSG_ACK:
+        {
+            int64_t bucket = (now - sent[msg.seq]) / NANOS_PER_MILLI;
+
+            histogram[bucket < RTT_BUCKETS ? bucket : RTT_BUCKETS - 1]++;
+            (*samples)++;
+            break;
+        }
+        case SYNC_MSG_JOIN:
+        {
+            // sync_decode dropped the baseline, so the next update goes out as a snapshot
+            player->resyncs++;
+            break;
+        }
+        default:
+        {
+            break;
+        }
+    }
+}
+
+static void observer_receive(observer_side *observer, const char *ip, in_port_t port)
+{
+    uint8_t      packet[SYNC_PACKET_MAX];
+    sync_message msg;
+    ssize_t      bytes;
+    size_t       len;
+
+    bytes = recv(observer->sock, packet, sizeof(packet), 0);
+    if(bytes < 0)
+    {
+        return;
+    }
+    switch(sync_decode(&observer->sync, packet, (size_t)bytes, &msg))
+    {
+        case SYNC_MSG_SNAPSHOT:
+        case SYNC_MSG_DELTA:
+        {
+            observer->view_seq = msg.seq;
+            observer->has_view = true;
+            observer->applied++;
+            len = sync_encode_ack(msg.seq, packet, sizeof(packet));
+            break;
+        }
+        case SYNC_MISSING_BASELINE:
+        {
+            observer->rejected++;
+            len = sync_encode_join(packet, sizeof(packet));
+            break;
+        }
+        default:
+        {
+            // Reordered or duplicated datagrams are stale and harmless
+            observer->rejected++;
+            return;
+        }
+    }
+    if(send_to(observer->sock, ip, port, packet, len) == 0)
+    {
+        observer->bytes_sent += len;
+    }
+}
+
+static double percentile(const uint32_t *histogram, int buckets, uint64_t samples, double fraction)
+{
+    uint64_t target;
+    uint64_t seen = 0;
+
+    if(samples == 0)
+    {
+        return 0.0;
+    }
+    target = (uint64_t)((double)samples * fraction);
+    for(int i = 0; i < buckets; i++)
+    {
+        seen += histogram[i];
+        if(seen > target)
+        {
+            return (double)i;
+        }
+    }
+    return (double)(buckets - 1);
+}